@@ -0,0 +1,939 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * dwm-bench: scripted X clients timing how dwm reacts, run by bench.sh
+ * against a headless server. Each scenario prints one line per metric:
+ *     <scenario> <metric> n=<samples> min=<us> med=<us> max=<us>
+ * If dwm was built with -DSTATS and $DWM_PID is set, the counters of the
+ * _DWM_STATS root property are printed per action as well:
+ *     <scenario> per-action <counter> <value>
+ *
+ * "replay <trace>" drives dwm with the client side of a $DWM_TRACE
+ * recording instead: stand-in windows are created, mapped, configured
+ * and destroyed as the recorded ones were, input goes through XTest and
+ * status text to the root name or the status socket. With -p the
+ * recorded pace is kept, otherwise it runs as fast as dwm keeps up.
+ *
+ * "layout" needs no display: it times the pure layouts of layout.c on
+ * 10, 100 and 1000 clients, -n being the number of rounds per size.
+ */
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <X11/Xatom.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/keysym.h>
+#include <X11/extensions/XTest.h>
+#include <X11/extensions/Xdamage.h>
+
+#include "layout.h"
+#include "trace.h"
+
+#define LENGTH(X)   (sizeof (X) / sizeof (X)[0])
+#define TIMEOUT_MS  1000
+#define SETTLE_MS   20
+#define MAX_COUNTERS 64
+
+typedef struct {
+	const char *name;
+	void (*run)(int);
+	int count;
+} Scenario;
+
+typedef struct {
+	char name[64];
+	unsigned long long value;
+} Counter;
+
+typedef struct {
+	Window recorded;
+	Window standin;
+} Standin;
+
+static void die(const char *msg);
+static long long now_us(void);
+static int wait_event(Window w, int type, XEvent *ev, int timeout_ms);
+static long long wait_tiled(Window w, int width, int height, int timeout_ms);
+static Window window_create(int x, int y, int w, int h, const char *title);
+static void report(const char *scenario, const char *metric, long long *samples, int n);
+static int stats_read(Counter *counters);
+static void stats_begin(void);
+static void stats_end(const char *scenario, int actions);
+static void key(KeySym sym, Bool press);
+static void key_combo(KeySym mod1, KeySym mod2, KeySym sym);
+static void bar_watch(void);
+static void bar_rearm(void);
+static int wait_bar(int timeout_ms);
+static void run_map(int n);
+static void run_tags(int n);
+static void run_alttab(int n);
+static void run_status(int n);
+static void run_drag(int n);
+static void run_icons(int n);
+static void run_transient(int n);
+static Window standin(Window recorded, int create);
+static void replay_event(const XEvent *ev, Window recorded_root);
+static int record_valid(const TraceRecord *record, const unsigned char *payload);
+static void replay(const char *path, int paced);
+static void run_layouts(int rounds);
+
+static Display *dpy;
+static Window root;
+static Atom net_wm_icon;
+static Counter stats_before[MAX_COUNTERS];
+static int nstats_before;
+static Standin *standins;
+static size_t nstandins, standins_size;
+static unsigned long replay_titles;
+static int status_socket = -1;
+static struct sockaddr_un status_address;
+static int damage_event;
+static Window bar;
+static Damage bar_damage;
+
+static const Scenario scenarios[] = {
+	/* name         function         default count */
+	{ "map",        run_map,         50  },
+	{ "tags",       run_tags,        100 },
+	{ "alttab",     run_alttab,      50  },
+	{ "status",     run_status,      200 },
+	{ "drag",       run_drag,        300 },
+	{ "icons",      run_icons,       30  },
+	{ "transient",  run_transient,   1   },
+};
+
+void
+die(const char *msg)
+{
+	fprintf(stderr, "dwm-bench: %s\n", msg);
+	exit(1);
+}
+
+long long
+now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* waits for an event of type on w, or on any window if w is None */
+int
+wait_event(Window w, int type, XEvent *ev, int timeout_ms)
+{
+	struct pollfd pfd = { .fd = ConnectionNumber(dpy), .events = POLLIN };
+	long long deadline = now_us() + timeout_ms * 1000LL;
+	long long left;
+
+	for (;;) {
+		while (XPending(dpy)) {
+			XNextEvent(dpy, ev);
+			if (ev->type == type && (w == None || ev->xany.window == w))
+				return 1;
+		}
+		if ((left = deadline - now_us()) <= 0)
+			return 0;
+		poll(&pfd, 1, (int)(left / 1000) + 1);
+	}
+}
+
+/* waits for w, created width x height, to be configured on screen at
+ * another size: the tile layout never leaves a bench window as it was
+ * created, while dwm maps it off screen at its own size. An arrange may
+ * configure a window more than once, so this goes on until no configure
+ * came for SETTLE_MS and returns when the last one arrived, 0 if none */
+long long
+wait_tiled(Window w, int width, int height, int timeout_ms)
+{
+	int screen_width = DisplayWidth(dpy, DefaultScreen(dpy));
+	long long deadline = now_us() + timeout_ms * 1000LL;
+	long long tiled = 0;
+	long long left;
+	XEvent ev;
+
+	while ((left = deadline - now_us()) > 0) {
+		XConfigureEvent *c = &ev.xconfigure;
+
+		if (tiled && tiled + SETTLE_MS * 1000LL - now_us() < left)
+			left = tiled + SETTLE_MS * 1000LL - now_us();
+		if (left <= 0 || !wait_event(w, ConfigureNotify, &ev, (int)(left / 1000) + 1))
+			break;
+		if (c->x >= 0 && c->x < screen_width && (c->width != width || c->height != height))
+			tiled = now_us();
+	}
+	return tiled;
+}
+
+Window
+window_create(int x, int y, int w, int h, const char *title)
+{
+	XClassHint class = { "dwm-bench", "dwm-bench" };
+	Window win;
+
+	win = XCreateSimpleWindow(dpy, root, x, y, (unsigned int)w, (unsigned int)h, 0, 0, 0);
+	XSelectInput(dpy, win, StructureNotifyMask | FocusChangeMask);
+	XStoreName(dpy, win, title);
+	XSetClassHint(dpy, win, &class);
+	return win;
+}
+
+static int
+compare(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+
+	return (x > y) - (x < y);
+}
+
+void
+report(const char *scenario, const char *metric, long long *samples, int n)
+{
+	if (n <= 0) {
+		printf("%s %s n=0\n", scenario, metric);
+		return;
+	}
+	qsort(samples, (size_t)n, sizeof(*samples), compare);
+	printf("%s %s n=%d min=%lld med=%lld max=%lld\n", scenario, metric, n,
+	       samples[0], samples[n / 2], samples[n - 1]);
+}
+
+/* asks dwm to publish _DWM_STATS and parses its counter lines */
+int
+stats_read(Counter *counters)
+{
+	Atom stats = XInternAtom(dpy, "_DWM_STATS", False), type;
+	unsigned long nitems, after;
+	unsigned char *data = NULL;
+	char *line, *save;
+	const char *pid;
+	int format, n = 0;
+	XEvent ev;
+
+	if (!(pid = getenv("DWM_PID")) || kill(atoi(pid), SIGUSR1) < 0)
+		return 0;
+	XSelectInput(dpy, root, PropertyChangeMask);
+	while (wait_event(root, PropertyNotify, &ev, TIMEOUT_MS))
+		if (ev.xproperty.atom == stats)
+			break;
+	XSelectInput(dpy, root, NoEventMask);
+
+	if (XGetWindowProperty(dpy, root, stats, 0, 1 << 20, False, XA_STRING,
+	                       &type, &format, &nitems, &after, &data) != Success || !data)
+		return 0;
+	for (line = strtok_r((char *)data, "\n", &save); line && n < MAX_COUNTERS;
+	     line = strtok_r(NULL, "\n", &save)) {
+		if (sscanf(line, "counter %63s %llu", counters[n].name, &counters[n].value) == 2)
+			n++;
+	}
+	XFree(data);
+	return n;
+}
+
+void
+stats_begin(void)
+{
+	nstats_before = stats_read(stats_before);
+}
+
+void
+stats_end(const char *scenario, int actions)
+{
+	Counter after[MAX_COUNTERS];
+	int i, n;
+
+	if (!nstats_before || !(n = stats_read(after)))
+		return;
+	for (i = 0; i < n && i < nstats_before; i++) {
+		if (after[i].value == stats_before[i].value)
+			continue;
+		printf("%s per-action %s %.2f\n", scenario, after[i].name,
+		       (double)(after[i].value - stats_before[i].value) / (actions ? actions : 1));
+	}
+}
+
+void
+key(KeySym sym, Bool press)
+{
+	XTestFakeKeyEvent(dpy, XKeysymToKeycode(dpy, sym), press, CurrentTime);
+}
+
+void
+key_combo(KeySym mod1, KeySym mod2, KeySym sym)
+{
+	if (mod1)
+		key(mod1, True);
+	if (mod2)
+		key(mod2, True);
+	key(sym, True);
+	key(sym, False);
+	if (mod2)
+		key(mod2, False);
+	if (mod1)
+		key(mod1, False);
+	XFlush(dpy);
+}
+
+/* watches the top bar of dwm, the highest of its "dwm" class windows on
+ * screen, so that a repaint shows up as a DamageNotify */
+void
+bar_watch(void)
+{
+	Window dummy, *children = NULL;
+	XWindowAttributes wa;
+	XClassHint class;
+	unsigned int i, n;
+	int top = -1;
+
+	if (!XQueryTree(dpy, root, &dummy, &dummy, &children, &n))
+		return;
+	for (i = 0; i < n; i++) {
+		if (!XGetClassHint(dpy, children[i], &class))
+			continue;
+		if (!strcmp(class.res_class, "dwm") && XGetWindowAttributes(dpy, children[i], &wa)
+		    && wa.y >= 0 && (top < 0 || wa.y < top)) {
+			bar = children[i];
+			top = wa.y;
+		}
+		XFree(class.res_name);
+		XFree(class.res_class);
+	}
+	XFree(children);
+	if (bar)
+		bar_damage = XDamageCreate(dpy, bar, XDamageReportNonEmpty);
+}
+
+/* forgets repaints so far, the next one reports again */
+void
+bar_rearm(void)
+{
+	XEvent ev;
+
+	if (!bar)
+		return;
+	XDamageSubtract(dpy, bar_damage, None, None);
+	XSync(dpy, False);
+	while (XCheckTypedWindowEvent(dpy, bar, damage_event + XDamageNotify, &ev))
+		;
+}
+
+/* waits for the top bar to be repainted */
+int
+wait_bar(int timeout_ms)
+{
+	XEvent ev;
+	int got;
+
+	if (!bar)
+		return 0;
+	got = wait_event(bar, damage_event + XDamageNotify, &ev, timeout_ms);
+	XDamageSubtract(dpy, bar_damage, None, None);
+	return got;
+}
+
+/* map-to-arranged: from XMapWindow to the ConfigureNotify giving the
+ * window its tiled geometry, after the deferred arrange */
+void
+run_map(int n)
+{
+	long long *samples = calloc((size_t)n, sizeof(*samples));
+	Window *wins = calloc((size_t)n, sizeof(*wins));
+	long long start, end;
+	int i, got = 0;
+
+	if (!samples || !wins)
+		die("cannot allocate");
+	stats_begin();
+	for (i = 0; i < n; i++) {
+		wins[i] = window_create(0, 0, 200, 200, "map");
+		start = now_us();
+		XMapWindow(dpy, wins[i]);
+		XFlush(dpy);
+		if ((end = wait_tiled(wins[i], 200, 200, TIMEOUT_MS)))
+			samples[got++] = end - start;
+	}
+	stats_end("map", n);
+	report("map", "map-to-arranged", samples, got);
+	for (i = 0; i < n; i++)
+		XDestroyWindow(dpy, wins[i]);
+	XSync(dpy, False);
+	free(samples);
+	free(wins);
+}
+
+/* half of the windows on tag 1, half on tag 2, then MODKEY+Tab flips */
+void
+run_tags(int n)
+{
+	enum { Clients = 40 };
+	long long *samples = calloc((size_t)n, sizeof(*samples));
+	Window wins[Clients];
+	long long start;
+	XEvent ev;
+	int i, got = 0;
+
+	if (!samples)
+		die("cannot allocate");
+	for (i = 0; i < Clients; i++) {
+		if (i == 0 || i == Clients / 2)
+			key_combo(XK_Super_L, XK_Control_L, i ? XK_2 : XK_1);
+		wins[i] = window_create(0, 0, 200, 200, "tags");
+		XMapWindow(dpy, wins[i]);
+		XFlush(dpy);
+		wait_event(wins[i], MapNotify, &ev, TIMEOUT_MS);
+	}
+
+	stats_begin();
+	for (i = 0; i < n; i++) {
+		/* the first window of the tag being shown moves back on screen */
+		Window target = wins[i % 2 ? Clients / 2 : 0];
+
+		start = now_us();
+		key_combo(XK_Super_L, 0, XK_Tab);
+		while (wait_event(target, ConfigureNotify, &ev, TIMEOUT_MS)) {
+			if (ev.xconfigure.x >= 0) {
+				samples[got++] = now_us() - start;
+				break;
+			}
+		}
+	}
+	stats_end("tags", n);
+	report("tags", "tag-switch", samples, got);
+	for (i = 0; i < Clients; i++)
+		XDestroyWindow(dpy, wins[i]);
+	XSync(dpy, False);
+	free(samples);
+}
+
+/* Alt+Tab only previews the pick in the bar and focuses on release:
+ * each round times the tap to the bar repaint and the release to the
+ * FocusIn it causes */
+void
+run_alttab(int n)
+{
+	enum { Clients = 8 };
+	long long *taps = calloc((size_t)n, sizeof(*taps));
+	long long *releases = calloc((size_t)n, sizeof(*releases));
+	Window wins[Clients];
+	long long start;
+	XEvent ev;
+	int i, ntaps = 0, nreleases = 0;
+
+	if (!taps || !releases)
+		die("cannot allocate");
+	for (i = 0; i < Clients; i++) {
+		wins[i] = window_create(0, 0, 200, 200, "alttab");
+		XMapWindow(dpy, wins[i]);
+		XFlush(dpy);
+		wait_event(wins[i], MapNotify, &ev, TIMEOUT_MS);
+	}
+
+	stats_begin();
+	for (i = 0; i < n; i++) {
+		key(XK_Alt_L, True);
+		bar_rearm();
+		start = now_us();
+		key(XK_Tab, True);
+		key(XK_Tab, False);
+		XFlush(dpy);
+		if (wait_bar(TIMEOUT_MS))
+			taps[ntaps++] = now_us() - start;
+		start = now_us();
+		key(XK_Alt_L, False);
+		XFlush(dpy);
+		if (wait_event(None, FocusIn, &ev, TIMEOUT_MS))
+			releases[nreleases++] = now_us() - start;
+	}
+	stats_end("alttab", n);
+	report("alttab", "tab-to-bar", taps, ntaps);
+	report("alttab", "release-to-focus", releases, nreleases);
+	for (i = 0; i < Clients; i++)
+		XDestroyWindow(dpy, wins[i]);
+	XSync(dpy, False);
+	free(taps);
+	free(releases);
+}
+
+/* root WM_NAME at 100 Hz, the way a status program feeds the bar,
+ * each update timed to the repaint of the top bar */
+void
+run_status(int n)
+{
+	long long *samples = calloc((size_t)n, sizeof(*samples));
+	long long start;
+	char text[256];
+	int i, got = 0;
+
+	if (!samples)
+		die("cannot allocate");
+	stats_begin();
+	for (i = 0; i < n; i++) {
+		snprintf(text, sizeof(text), "cpu %2d%%\x02mem %d\x03%lld", i % 100, i, now_us());
+		bar_rearm();
+		start = now_us();
+		XStoreName(dpy, root, text);
+		XFlush(dpy);
+		if (wait_bar(TIMEOUT_MS))
+			samples[got++] = now_us() - start;
+		usleep(10000);
+	}
+	stats_end("status", n);
+	report("status", "update-to-bar", samples, got);
+	free(samples);
+}
+
+/* MODKEY+Button1 drag of a fixed size, hence floating, window */
+void
+run_drag(int n)
+{
+	long long *samples = calloc((size_t)n, sizeof(*samples));
+	XSizeHints hints;
+	long long start;
+	Window win;
+	XEvent ev;
+	int i, got = 0;
+
+	if (!samples)
+		die("cannot allocate");
+	win = window_create(100, 100, 300, 300, "drag");
+	hints.min_width = hints.max_width = hints.min_height = hints.max_height = 300;
+	hints.flags = PMinSize | PMaxSize;
+	XSetWMNormalHints(dpy, win, &hints);
+	XMapWindow(dpy, win);
+	XFlush(dpy);
+	wait_event(win, MapNotify, &ev, TIMEOUT_MS);
+
+	stats_begin();
+	XTestFakeMotionEvent(dpy, -1, 250, 250, CurrentTime);
+	key(XK_Super_L, True);
+	XTestFakeButtonEvent(dpy, Button1, True, CurrentTime);
+	XFlush(dpy);
+	for (i = 0; i < n; i++) {
+		start = now_us();
+		XTestFakeMotionEvent(dpy, -1, 250 + i % 200, 250 + i % 100, CurrentTime);
+		XFlush(dpy);
+		if (wait_event(win, ConfigureNotify, &ev, TIMEOUT_MS / 10))
+			samples[got++] = now_us() - start;
+	}
+	XTestFakeButtonEvent(dpy, Button1, False, CurrentTime);
+	key(XK_Super_L, False);
+	XFlush(dpy);
+	stats_end("drag", n);
+	report("drag", "motion-to-configure", samples, got);
+	XDestroyWindow(dpy, win);
+	XSync(dpy, False);
+	free(samples);
+}
+
+/* clients with a full _NET_WM_ICON set, from 256x256 down to 16x16 */
+void
+run_icons(int n)
+{
+	static const int sizes[] = { 256, 128, 64, 48, 32, 16 };
+	long long *samples = calloc((size_t)n, sizeof(*samples));
+	Window *wins = calloc((size_t)n, sizeof(*wins));
+	unsigned long *icon, *p;
+	size_t i, length = 0;
+	long long start, end;
+	int j, got = 0;
+
+	for (i = 0; i < LENGTH(sizes); i++)
+		length += 2 + (size_t)(sizes[i] * sizes[i]);
+	if (!samples || !wins || !(icon = calloc(length, sizeof(*icon))))
+		die("cannot allocate");
+
+	stats_begin();
+	for (j = 0; j < n; j++) {
+		for (i = 0, p = icon; i < LENGTH(sizes); i++) {
+			size_t k, pixels = (size_t)(sizes[i] * sizes[i]);
+
+			*p++ = (unsigned long)sizes[i];
+			*p++ = (unsigned long)sizes[i];
+			/* different pixels per client so nothing is shared */
+			for (k = 0; k < pixels; k++)
+				*p++ = 0xff000000UL | ((k * 2654435761UL + (size_t)j) & 0xffffffUL);
+		}
+		wins[j] = window_create(0, 0, 200, 200, "icons");
+		XChangeProperty(dpy, wins[j], net_wm_icon, XA_CARDINAL, 32,
+		                PropModeReplace, (unsigned char *)icon, (int)length);
+		start = now_us();
+		XMapWindow(dpy, wins[j]);
+		XFlush(dpy);
+		if ((end = wait_tiled(wins[j], 200, 200, TIMEOUT_MS)))
+			samples[got++] = end - start;
+	}
+	stats_end("icons", n);
+	report("icons", "map-to-arranged", samples, got);
+	for (j = 0; j < n; j++)
+		XDestroyWindow(dpy, wins[j]);
+	XSync(dpy, False);
+	free(icon);
+	free(samples);
+	free(wins);
+}
+
+/* the original transient.c: a fixed size window, then a transient for it */
+void
+run_transient(int n)
+{
+	long long samples[1];
+	XSizeHints h;
+	long long start;
+	Window f, t;
+	XEvent ev;
+	int got = 0;
+
+	(void)n;
+	f = window_create(100, 100, 400, 400, "floating");
+	h.min_width = h.max_width = h.min_height = h.max_height = 400;
+	h.flags = PMinSize | PMaxSize;
+	XSetWMNormalHints(dpy, f, &h);
+	XMapWindow(dpy, f);
+	XFlush(dpy);
+	wait_event(f, MapNotify, &ev, TIMEOUT_MS);
+
+	t = window_create(50, 50, 100, 100, "transient");
+	XSetTransientForHint(dpy, t, f);
+	start = now_us();
+	XMapWindow(dpy, t);
+	XFlush(dpy);
+	if (wait_event(t, MapNotify, &ev, TIMEOUT_MS))
+		samples[got++] = now_us() - start;
+	report("transient", "map-to-arranged", samples, got);
+	XDestroyWindow(dpy, t);
+	XDestroyWindow(dpy, f);
+	XSync(dpy, False);
+}
+
+/* stand-in for a recorded window, created on first sight if asked to */
+Window
+standin(Window recorded, int create)
+{
+	Standin *s;
+	size_t i;
+
+	for (i = 0; i < nstandins; i++)
+		if (standins[i].recorded == recorded)
+			return standins[i].standin;
+	if (!create)
+		return None;
+	if (nstandins == standins_size) {
+		standins_size = standins_size ? standins_size * 2 : 64;
+		if (!(s = realloc(standins, standins_size * sizeof(*s))))
+			die("cannot allocate");
+		standins = s;
+	}
+	standins[nstandins].recorded = recorded;
+	standins[nstandins].standin = window_create(0, 0, 640, 480, "replay");
+	return standins[nstandins++].standin;
+}
+
+void
+replay_event(const XEvent *ev, Window recorded_root)
+{
+	XSetWindowAttributes wa;
+	XWindowChanges wc;
+	char title[32];
+	Window w;
+	size_t i;
+
+	switch (ev->type) {
+	case CreateNotify:
+		if (ev->xcreatewindow.parent != recorded_root || standin(ev->xcreatewindow.window, 0))
+			break;
+		w = standin(ev->xcreatewindow.window, 1);
+		wa.override_redirect = ev->xcreatewindow.override_redirect;
+		XChangeWindowAttributes(dpy, w, CWOverrideRedirect, &wa);
+		XMoveResizeWindow(dpy, w, ev->xcreatewindow.x, ev->xcreatewindow.y,
+		                  (unsigned int)ev->xcreatewindow.width, (unsigned int)ev->xcreatewindow.height);
+		break;
+	case MapRequest:
+		XMapWindow(dpy, standin(ev->xmaprequest.window, 1));
+		break;
+	case ConfigureRequest:
+		if (!(w = standin(ev->xconfigurerequest.window, 0)))
+			break;
+		wc.x = ev->xconfigurerequest.x;
+		wc.y = ev->xconfigurerequest.y;
+		wc.width = ev->xconfigurerequest.width;
+		wc.height = ev->xconfigurerequest.height;
+		wc.border_width = ev->xconfigurerequest.border_width;
+		wc.stack_mode = ev->xconfigurerequest.detail;
+		XConfigureWindow(dpy, w, (unsigned int)ev->xconfigurerequest.value_mask
+		                 & (CWX | CWY | CWWidth | CWHeight | CWBorderWidth | CWStackMode), &wc);
+		break;
+	case PropertyNotify:
+		/* titles are the property clients change the most */
+		if (ev->xproperty.atom != XA_WM_NAME || !(w = standin(ev->xproperty.window, 0)))
+			break;
+		snprintf(title, sizeof(title), "replay %lu", ++replay_titles);
+		XStoreName(dpy, w, title);
+		break;
+	case UnmapNotify:
+		if (!ev->xunmap.send_event && (w = standin(ev->xunmap.window, 0)))
+			XUnmapWindow(dpy, w);
+		break;
+	case DestroyNotify:
+		for (i = 0; i < nstandins; i++) {
+			if (standins[i].recorded == ev->xdestroywindow.window) {
+				XDestroyWindow(dpy, standins[i].standin);
+				standins[i] = standins[--nstandins];
+				break;
+			}
+		}
+		break;
+	case KeyPress:
+	case KeyRelease:
+		XTestFakeKeyEvent(dpy, ev->xkey.keycode, ev->type == KeyPress, CurrentTime);
+		break;
+	case ButtonPress:
+	case ButtonRelease:
+		XTestFakeMotionEvent(dpy, -1, ev->xbutton.x_root, ev->xbutton.y_root, CurrentTime);
+		XTestFakeButtonEvent(dpy, ev->xbutton.button, ev->type == ButtonPress, CurrentTime);
+		break;
+	case MotionNotify:
+		XTestFakeMotionEvent(dpy, -1, ev->xmotion.x_root, ev->xmotion.y_root, CurrentTime);
+		break;
+	default:
+		break;
+	}
+}
+
+/* the payload size matches the kind: an XEvent of this build for
+ * events, NUL terminated text for the status ones */
+int
+record_valid(const TraceRecord *record, const unsigned char *payload)
+{
+	switch (record->kind) {
+	case TraceEvent:
+		return record->size == sizeof(XEvent);
+	case TraceStatus:
+	case TraceStatusBlock:
+		return record->size > 0 && payload[record->size - 1] == '\0';
+	default:
+		return 1; /* from a later writer, skipped */
+	}
+}
+
+void
+replay(const char *path, int paced)
+{
+	const TraceHeader *header;
+	const TraceRecord *record;
+	const unsigned char *data, *p, *end;
+	unsigned long events = 0, records = 0;
+	long long start, recorded_start = 0, late;
+	const char *socket_path;
+	struct stat st;
+	XEvent ev;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+		die("cannot open trace");
+	if ((size_t)st.st_size < sizeof(*header))
+		die("trace too short");
+	if ((data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+		die("cannot map trace");
+	close(fd);
+	header = (const TraceHeader *)(const void *)data;
+	if (header->magic != TRACE_MAGIC || header->version != TRACE_VERSION
+	    || header->event_size != sizeof(XEvent))
+		die("not a trace of this dwm build");
+
+	if ((socket_path = getenv("DWM_STATUS_SOCKET"))
+	    && strlen(socket_path) < sizeof(status_address.sun_path)) {
+		status_address.sun_family = AF_UNIX;
+		strcpy(status_address.sun_path, socket_path);
+		status_socket = socket(AF_UNIX, SOCK_DGRAM, 0);
+	}
+
+	stats_begin();
+	start = now_us();
+	end = data + st.st_size;
+	for (p = data + sizeof(*header); p + sizeof(*record) <= end;
+	     p += TRACE_PADDED(sizeof(*record) + record->size)) {
+		record = (const TraceRecord *)(const void *)p;
+		if (p + sizeof(*record) + record->size > end)
+			break;
+		if (!record_valid(record, p + sizeof(*record))) {
+			fprintf(stderr, "dwm-bench: bad record of kind %u, size %u at offset %ld, replay stopped\n",
+			        record->kind, record->size, (long)(p - data));
+			break;
+		}
+		if (paced) {
+			if (!recorded_start)
+				recorded_start = (long long)(record->time_ns / 1000);
+			late = now_us() - start - ((long long)(record->time_ns / 1000) - recorded_start);
+			if (late < 0) {
+				XFlush(dpy);
+				usleep((useconds_t)-late);
+			}
+		}
+		switch (record->kind) {
+		case TraceEvent:
+			memcpy(&ev, p + sizeof(*record), sizeof(ev));
+			replay_event(&ev, (Window)header->root);
+			events++;
+			break;
+		case TraceStatus:
+			XStoreName(dpy, root, (const char *)(p + sizeof(*record)));
+			break;
+		case TraceStatusBlock:
+			if (status_socket >= 0)
+				sendto(status_socket, p + sizeof(*record), record->size - 1, 0,
+				       (struct sockaddr *)&status_address, sizeof(status_address));
+			break;
+		default:
+			break;
+		}
+		/* keep the server queue and our event queue small */
+		if (++records % 64 == 0) {
+			XSync(dpy, False);
+			while (XPending(dpy))
+				XNextEvent(dpy, &ev);
+		}
+	}
+	XSync(dpy, False);
+	printf("replay events=%lu wall_us=%lld\n", events, now_us() - start);
+	stats_end("replay", (int)events);
+
+	while (nstandins)
+		XDestroyWindow(dpy, standins[--nstandins].standin);
+	XSync(dpy, False);
+	munmap((void *)(uintptr_t)data, (size_t)st.st_size);
+	free(standins);
+}
+
+/* a monitor of 2560x1440 under a bar, every third client a terminal
+ * with character cell increments so the hints path is taken too */
+void
+run_layouts(int rounds)
+{
+	static const struct {
+		const char *name;
+		LayoutFunction *function;
+	} layouts[] = {
+		{ "tile",    layout_tile },
+		{ "monocle", layout_monocle },
+		{ "grid",    layout_grid },
+		{ "columns", layout_columns },
+	};
+	static const int sizes[] = { 10, 100, 1000 };
+	LayoutArea area = {
+		.x = 0, .y = 24, .w = 2560, .h = 1416,
+		.number_masters = 1, .master_fact = 0.5f, .min_size = 24,
+	};
+	LayoutClient *clients;
+	LayoutRect *plan;
+	long long *samples;
+	char metric[32];
+	size_t l, s;
+	int i, r, n;
+
+	n = sizes[LENGTH(sizes) - 1];
+	clients = calloc((size_t)n, sizeof(*clients));
+	plan = calloc((size_t)n, sizeof(*plan));
+	samples = calloc((size_t)rounds, sizeof(*samples));
+	if (!clients || !plan || !samples)
+		die("calloc failed");
+	for (i = 0; i < n; i++) {
+		clients[i].w = 800;
+		clients[i].h = 600;
+		clients[i].border = 3;
+		clients[i].apply_hints = true;
+		if (i % 3 == 0) {
+			clients[i].hints.base_w = clients[i].hints.min_w = 4;
+			clients[i].hints.base_h = clients[i].hints.min_h = 4;
+			clients[i].hints.increment_w = 9;
+			clients[i].hints.increment_h = 19;
+		}
+	}
+
+	for (l = 0; l < LENGTH(layouts); l++) {
+		for (s = 0; s < LENGTH(sizes); s++) {
+			for (r = 0; r < rounds; r++) {
+				long long start = now_us();
+
+				layouts[l].function(&area, clients, sizes[s], plan);
+				samples[r] = now_us() - start;
+			}
+			snprintf(metric, sizeof(metric), "n=%d", sizes[s]);
+			report(layouts[l].name, metric, samples, rounds);
+		}
+	}
+	free(samples);
+	free(plan);
+	free(clients);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int i, count = 0, ran = 0, paced = 0, dummy;
+
+	for (; argc > 1 && argv[1][0] == '-'; argc--, argv++) {
+		if (!strcmp(argv[1], "-p")) {
+			paced = 1;
+		} else if (!strcmp(argv[1], "-n") && argc > 2) {
+			count = atoi(argv[2]);
+			argc--;
+			argv++;
+		} else {
+			break;
+		}
+	}
+	if (argc < 2) {
+		fputs("usage: dwm-bench [-n count] scenario...|all\n"
+		      "       dwm-bench [-p] replay trace\n"
+		      "       dwm-bench [-n rounds] layout\n", stderr);
+		return 1;
+	}
+	if (!strcmp(argv[1], "layout")) {
+		run_layouts(count > 0 ? count : 1000);
+		return 0;
+	}
+	if (!(dpy = XOpenDisplay(NULL)))
+		die("cannot open display");
+	if (!XTestQueryExtension(dpy, &dummy, &dummy, &dummy, &dummy))
+		die("XTest extension missing");
+	if (!XDamageQueryExtension(dpy, &damage_event, &dummy))
+		die("DAMAGE extension missing");
+	root = DefaultRootWindow(dpy);
+	net_wm_icon = XInternAtom(dpy, "_NET_WM_ICON", False);
+
+	if (!strcmp(argv[1], "replay")) {
+		if (argc < 3)
+			die("replay needs a trace");
+		replay(argv[2], paced);
+		XCloseDisplay(dpy);
+		return 0;
+	}
+
+	bar_watch();
+	for (i = 1; i < argc; i++) {
+		size_t s;
+
+		for (s = 0; s < LENGTH(scenarios); s++) {
+			if (strcmp(argv[i], "all") && strcmp(argv[i], scenarios[s].name))
+				continue;
+			scenarios[s].run(count > 0 ? count : scenarios[s].count);
+			fflush(stdout);
+			ran++;
+		}
+	}
+	XCloseDisplay(dpy);
+	if (!ran)
+		die("no such scenario");
+	return 0;
+}
@@ -0,0 +1,49 @@
+#!/bin/sh
+# Runs dwm on a headless Xvfb and times it with dwm-bench.
+# usage: bench.sh [scenario...]    (default: all)
+# Build dwm with STATSFLAGS = -DSTATS to also get requests per action.
+
+display=${BENCH_DISPLAY:-:99}
+screen=${BENCH_SCREEN:-1920x1080x24}
+bench=${BENCH:-./dwm-bench}
+dwm=${DWM:-./dwm}
+
+# keep the cache and runtime files of the real session out of it
+tmp=$(mktemp -d) || exit 1
+Xvfb "$display" -screen 0 "$screen" -nolisten tcp >/dev/null 2>&1 &
+xvfb=$!
+trap 'kill $dwm_pid $xvfb 2>/dev/null; wait 2>/dev/null; rm -rf "$tmp"' EXIT
+trap 'exit 1' INT TERM
+
+export DISPLAY="$display"
+tries=0
+until xdpyinfo >/dev/null 2>&1; do
+	tries=$((tries + 1))
+	if [ "$tries" -gt 50 ]; then
+		echo "bench.sh: Xvfb did not start on $display" >&2
+		exit 1
+	fi
+	sleep 0.1
+done
+
+XDG_CACHE_HOME="$tmp" XDG_RUNTIME_DIR="$tmp" "$dwm" 2>"$tmp/dwm.log" &
+dwm_pid=$!
+# dwm sets _NET_SUPPORTING_WM_CHECK on the root once it manages the screen
+tries=0
+until xprop -root _NET_SUPPORTING_WM_CHECK 2>/dev/null | grep -q 'window id'; do
+	tries=$((tries + 1))
+	if ! kill -0 "$dwm_pid" 2>/dev/null; then
+		echo "bench.sh: dwm exited, see its log:" >&2
+		cat "$tmp/dwm.log" >&2
+		exit 1
+	fi
+	if [ "$tries" -gt 50 ]; then
+		echo "bench.sh: dwm did not take the screen on $display" >&2
+		exit 1
+	fi
+	sleep 0.1
+done
+
+[ $# -eq 0 ] && set -- all
+DWM_PID=$dwm_pid "$bench" "$@"
+exit $?
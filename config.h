@@ -6,8 +6,6 @@ static const bool lockfullscreen = false;
 static const unsigned int border_pixels = 3;
 static const unsigned int tabModKey = 0x40;
 static const unsigned int tabCycleKey = 0x17;
-static const unsigned int key_j = 44;
-static const unsigned int key_semicolon = 47;
 static const unsigned int key_l = 46;
 static const unsigned int key_k = 45;
 static const unsigned int superKey = 133;
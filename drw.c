@@ -1,7 +1,9 @@
 /* See LICENSE file for copyright and license details. */
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <X11/Xlib.h>
 #include <X11/Xft/Xft.h>
 #include <Imlib2.h>
@@ -21,6 +23,40 @@ static const long utfmax[UTF_SIZ + 1] = {0x10FFFF, 0x7F, 0x7FF, 0xFFFF, 0x10FFFF
 
 static void die(const char *, ...) __attribute__((noreturn));
 static void *ecalloc(size_t nmemb, size_t size);
+static int text_draw(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lpad, const char *text, int invert, int fill);
+static unsigned long widthcache_hash(const char *text, size_t *len);
+
+/* bumped whenever any fontset changes, which makes every cached width stale */
+static unsigned int fontset_generation = 1;
+
+/* codepoint -> font map shared by every Drw using the same fontset.
+ * Found entries point at the first font of the set with the glyph,
+ * Missing ones remember that fontconfig has no font for it at all and
+ * Pending ones name a fallback from the on-disk cache, opened only once
+ * one of its glyphs is drawn. Stale slots are occupied but unresolved. */
+enum { FontMapFree, FontMapStale, FontMapFound, FontMapMissing, FontMapPending };
+typedef struct {
+	long codepoint;
+	Fnt *font;
+	int pattern;
+	int state;
+} FontMapEntry;
+
+typedef struct {
+	char *name;
+	Fnt *font;
+	int failed;
+} FontMapPattern;
+
+static struct {
+	const Fnt *set;
+	FontMapEntry *entries;
+	size_t capacity, count;
+	FontMapPattern *patterns;
+	size_t npatterns, patterns_capacity;
+} fontmap;
+
+static const char fontmap_magic[] = "dwm-fontmap 1\n";
 
 void *
 ecalloc(size_t nmemb, size_t size)
@@ -113,7 +149,9 @@ drw_create(Display *dpy, int screen, Window root, unsigned int w, unsigned int h
 	drw->drawable = XCreatePixmap(dpy, root, w, h, depth);
 	drw->picture = XRenderCreatePicture(dpy, drw->drawable, XRenderFindVisualFormat(dpy, visual), 0, NULL);
 	drw->gc = XCreateGC(dpy, drw->drawable, 0, NULL);
+	drw->xftdraw = XftDrawCreate(dpy, drw->drawable, visual, cmap);
 	XSetLineAttributes(dpy, drw->gc, 1, LineSolid, CapButt, JoinMiter);
+	drw->widths = ecalloc(WidthCacheSets, sizeof(*drw->widths));
 
 	return drw;
 }
@@ -132,15 +170,18 @@ drw_resize(Drw *drw, unsigned int w, unsigned int h)
 		XFreePixmap(drw->dpy, drw->drawable);
 	drw->drawable = XCreatePixmap(drw->dpy, drw->root, w, h, drw->depth);
 	drw->picture = XRenderCreatePicture(drw->dpy, drw->drawable, XRenderFindVisualFormat(drw->dpy, drw->visual), 0, NULL);
+	XftDrawChange(drw->xftdraw, drw->drawable);
 }
 
 void
 drw_free(Drw *drw)
 {
+	XftDrawDestroy(drw->xftdraw);
 	XRenderFreePicture(drw->dpy, drw->picture);
 	XFreePixmap(drw->dpy, drw->drawable);
 	XFreeGC(drw->dpy, drw->gc);
 	drw_fontset_free(drw->fonts);
+	free(drw->widths);
 	free(drw);
 }
 
@@ -198,6 +239,345 @@ xfont_free(Fnt *font)
 	free(font);
 }
 
+static void
+fontmap_clear(void)
+{
+	size_t i;
+
+	for (i = 0; i < fontmap.npatterns; i++)
+		free(fontmap.patterns[i].name);
+	free(fontmap.patterns);
+	free(fontmap.entries);
+	memset(&fontmap, 0, sizeof(fontmap));
+}
+
+static size_t
+fontmap_hash(long codepoint)
+{
+	unsigned long hash = (unsigned long)codepoint * 2654435761UL;
+
+	return (size_t)(hash ^ (hash >> 15));
+}
+
+static void
+fontmap_grow(void)
+{
+	FontMapEntry *old = fontmap.entries;
+	size_t i, j, mask, capacity = fontmap.capacity;
+
+	fontmap.capacity = capacity ? capacity * 2 : 512;
+	fontmap.entries = ecalloc(fontmap.capacity, sizeof(*fontmap.entries));
+	mask = fontmap.capacity - 1;
+	for (i = 0; i < capacity; i++) {
+		if (old[i].state == FontMapFree)
+			continue;
+		for (j = fontmap_hash(old[i].codepoint) & mask;
+		     fontmap.entries[j].state != FontMapFree; j = (j + 1) & mask)
+			; /* NOP */
+		fontmap.entries[j] = old[i];
+	}
+	free(old);
+}
+
+/* returns the slot of codepoint, adding a stale one if it is unknown;
+ * the pointer is only valid until the next call */
+static FontMapEntry *
+fontmap_slot(long codepoint)
+{
+	FontMapEntry *entry;
+	size_t i, mask;
+
+	if ((fontmap.count + 1) * 4 > fontmap.capacity * 3)
+		fontmap_grow();
+
+	mask = fontmap.capacity - 1;
+	for (i = fontmap_hash(codepoint) & mask;; i = (i + 1) & mask) {
+		entry = &fontmap.entries[i];
+		if (entry->state == FontMapFree)
+			break;
+		if (entry->codepoint == codepoint)
+			return entry;
+	}
+	entry->codepoint = codepoint;
+	entry->font = NULL;
+	entry->pattern = -1;
+	entry->state = FontMapStale;
+	fontmap.count++;
+	return entry;
+}
+
+static int
+fontmap_add_pattern(const char *name, Fnt *font)
+{
+	FontMapPattern *pattern;
+	size_t len = strlen(name);
+
+	if (fontmap.npatterns == fontmap.patterns_capacity) {
+		fontmap.patterns_capacity = fontmap.patterns_capacity ? fontmap.patterns_capacity * 2 : 8;
+		if (!(pattern = realloc(fontmap.patterns, fontmap.patterns_capacity * sizeof(*pattern))))
+			die("error, cannot allocate font map:");
+		fontmap.patterns = pattern;
+	}
+	pattern = &fontmap.patterns[fontmap.npatterns];
+	pattern->name = ecalloc(1, len + 1);
+	memcpy(pattern->name, name, len);
+	pattern->font = font;
+	pattern->failed = 0;
+	return (int)fontmap.npatterns++;
+}
+
+static int
+fontmap_pattern_of(const Fnt *font)
+{
+	size_t i;
+
+	for (i = 0; i < fontmap.npatterns; i++) {
+		if (fontmap.patterns[i].font == font)
+			return (int)i;
+	}
+	return -1;
+}
+
+static void
+fontset_append(Drw *drw, Fnt *font)
+{
+	Fnt *cur;
+
+	for (cur = drw->fonts; cur->next; cur = cur->next)
+		; /* NOP */
+	cur->next = font;
+	/* strings measured without this font may now differ */
+	fontset_generation++;
+}
+
+/* opens a cached fallback by the name saved with drw_fontmap_save */
+static Fnt *
+fontmap_open(Drw *drw, int id)
+{
+	FontMapPattern *pattern = &fontmap.patterns[id];
+	FcPattern *fcpattern;
+	Fnt *font = NULL;
+
+	if (pattern->font || pattern->failed)
+		return pattern->font;
+
+	if ((fcpattern = FcNameParse((const FcChar8 *)pattern->name))) {
+		if ((font = xfont_create(drw, NULL, fcpattern)))
+			fontset_append(drw, font);
+		else
+			FcPatternDestroy(fcpattern);
+	}
+	pattern->font = font;
+	pattern->failed = !font;
+	return font;
+}
+
+/* font to draw codepoint with, or NULL if no font of the set has it.
+ * *missing tells whether fontconfig is already known to have nothing */
+static Fnt *
+fontmap_font(Drw *drw, long codepoint, int *missing)
+{
+	FontMapEntry *entry;
+	Fnt *font;
+
+	if (fontmap.set != drw->fonts) {
+		fontmap_clear();
+		fontmap.set = drw->fonts;
+	}
+
+	*missing = 0;
+	entry = fontmap_slot(codepoint);
+	switch (entry->state) {
+	case FontMapFound:
+		return entry->font;
+	case FontMapMissing:
+		*missing = 1;
+		return NULL;
+	case FontMapPending:
+		font = fontmap_open(drw, entry->pattern);
+		if (font && XftCharExists(drw->dpy, font->xfont, (FcChar32)codepoint)) {
+			entry->state = FontMapFound;
+			entry->font = font;
+			return font;
+		}
+		break;
+	default:
+		break;
+	}
+
+	for (font = drw->fonts; font; font = font->next) {
+		if (XftCharExists(drw->dpy, font->xfont, (FcChar32)codepoint))
+			break;
+	}
+	entry->state = font ? FontMapFound : FontMapStale;
+	entry->font = font;
+	return font;
+}
+
+static void
+fontmap_set(long codepoint, Fnt *font)
+{
+	FontMapEntry *entry = fontmap_slot(codepoint);
+
+	entry->state = font ? FontMapFound : FontMapMissing;
+	entry->font = font;
+}
+
+/* newest mtime of the fontconfig configuration and font directories,
+ * installing or removing fonts or editing fonts.conf changes it */
+static long long
+fontmap_stamp(void)
+{
+	FcStrList *list;
+	FcChar8 *path;
+	struct stat st;
+	long long stamp = 0;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (!(list = i ? FcConfigGetFontDirs(NULL) : FcConfigGetConfigFiles(NULL)))
+			continue;
+		while ((path = FcStrListNext(list))) {
+			if (!stat((const char *)path, &st) && (long long)st.st_mtime > stamp)
+				stamp = (long long)st.st_mtime;
+		}
+		FcStrListDone(list);
+	}
+	return stamp;
+}
+
+/* the configured fonts decide which fallbacks get matched */
+static unsigned long
+fontmap_fonts_hash(Drw *drw)
+{
+	unsigned long hash = 0;
+	FcChar8 *name;
+	Fnt *font;
+	size_t len;
+
+	for (font = drw->fonts; font; font = font->next) {
+		if (!font->pattern || !(name = FcNameUnparse(font->pattern)))
+			continue;
+		hash = hash * 31 + widthcache_hash((const char *)name, &len);
+		free(name);
+	}
+	return hash;
+}
+
+/* Loads the fallback map saved by drw_fontmap_save. Nothing is opened
+ * here, fonts are loaded when the first of their glyphs gets drawn.
+ * Returns 0 if the cache is absent or stale. */
+int
+drw_fontmap_load(Drw *drw, const char *path)
+{
+	FontMapEntry *entry;
+	FILE *file;
+	char line[4096];
+	unsigned long hash;
+	long long stamp;
+	unsigned long codepoint;
+	int id, n;
+
+	if (!drw || !drw->fonts || !path || !(file = fopen(path, "r")))
+		return 0;
+
+	fontmap_clear();
+	fontmap.set = drw->fonts;
+	if (!fgets(line, sizeof(line), file) || strcmp(line, fontmap_magic)
+	    || !fgets(line, sizeof(line), file)
+	    || sscanf(line, "stamp %lld %lx", &stamp, &hash) != 2
+	    || stamp != fontmap_stamp() || hash != fontmap_fonts_hash(drw)) {
+		fclose(file);
+		return 0;
+	}
+
+	while (fgets(line, sizeof(line), file)) {
+		line[strcspn(line, "\n")] = '\0';
+		if (sscanf(line, "p %d %n", &id, &n) == 1) {
+			if (id == (int)fontmap.npatterns)
+				fontmap_add_pattern(line + n, NULL);
+		} else if (sscanf(line, "c %lx %d", &codepoint, &id) == 2) {
+			if (id >= (int)fontmap.npatterns)
+				continue;
+			entry = fontmap_slot((long)codepoint);
+			entry->state = id < 0 ? FontMapMissing : FontMapPending;
+			entry->pattern = id;
+		}
+	}
+	fclose(file);
+	return 1;
+}
+
+/* Writes every fallback and every codepoint without a font to path,
+ * through a temporary file so a crash never leaves a torn cache. */
+int
+drw_fontmap_save(Drw *drw, const char *path)
+{
+	FontMapEntry *entry;
+	FcPattern *fcpattern;
+	FcChar8 *name;
+	FILE *file;
+	char tmp[PATH_MAX];
+	int *ids, id;
+	size_t i;
+	int next = 0;
+	Fnt *font;
+
+	if (!drw || !drw->fonts || !path || fontmap.set != drw->fonts)
+		return 0;
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+		return 0;
+
+	/* fallbacks matched this session, charset and lang only bloat the
+	 * name and Xft computes them again when opening */
+	for (font = drw->fonts; font; font = font->next) {
+		if (font->pattern || fontmap_pattern_of(font) >= 0)
+			continue;
+		fcpattern = FcPatternDuplicate(font->xfont->pattern);
+		FcPatternDel(fcpattern, FC_CHARSET);
+		FcPatternDel(fcpattern, FC_LANG);
+		if ((name = FcNameUnparse(fcpattern))) {
+			fontmap_add_pattern((const char *)name, font);
+			free(name);
+		}
+		FcPatternDestroy(fcpattern);
+	}
+
+	if (!(file = fopen(tmp, "w")))
+		return 0;
+
+	fprintf(file, "%sstamp %lld %lx\n", fontmap_magic, fontmap_stamp(), fontmap_fonts_hash(drw));
+	ids = ecalloc(fontmap.npatterns + 1, sizeof(*ids));
+	for (i = 0; i < fontmap.npatterns; i++) {
+		ids[i] = fontmap.patterns[i].failed ? -1 : next++;
+		if (ids[i] >= 0)
+			fprintf(file, "p %d %s\n", ids[i], fontmap.patterns[i].name);
+	}
+	for (i = 0; i < fontmap.capacity; i++) {
+		entry = &fontmap.entries[i];
+		if (entry->state == FontMapMissing) {
+			fprintf(file, "c %lx -1\n", (unsigned long)entry->codepoint);
+			continue;
+		}
+		if (entry->state == FontMapFound)
+			id = fontmap_pattern_of(entry->font);
+		else if (entry->state == FontMapPending)
+			id = entry->pattern;
+		else
+			continue;
+		/* glyphs of the configured fonts are cheap to find again */
+		if (id >= 0 && ids[id] >= 0)
+			fprintf(file, "c %lx %d\n", (unsigned long)entry->codepoint, ids[id]);
+	}
+	free(ids);
+
+	if (fclose(file) || rename(tmp, path)) {
+		remove(tmp);
+		return 0;
+	}
+	return 1;
+}
+
 Fnt*
 drw_fontset_create(Drw* drw, const char *fonts[], size_t fontcount)
 {
@@ -207,6 +587,7 @@ drw_fontset_create(Drw* drw, const char *fonts[], size_t fontcount)
 	if (!drw || !fonts)
 		return NULL;
 
+	fontset_generation++;
 	for (i = 1; i <= fontcount; i++) {
 		if ((cur = xfont_create(drw, fonts[fontcount - i], NULL))) {
 			cur->next = ret;
@@ -220,6 +601,9 @@ void
 drw_fontset_free(Fnt *font)
 {
 	if (font) {
+		fontset_generation++;
+		if (font == fontmap.set)
+			fontmap_clear();
 		drw_fontset_free(font->next);
 		xfont_free(font);
 	}
@@ -352,9 +736,66 @@ drw_rect(Drw *drw, int x, int y, unsigned int w, unsigned int h, int filled, int
 int
 drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lpad, const char *text, int invert)
 {
-	int i, ty, ellipsis_x = 0;
+	return text_draw(drw, x, y, w, h, lpad, text, invert, 1);
+}
+
+void
+drw_texts(Drw *drw, const DrwText *texts, size_t count)
+{
+	enum { chunk_len = 64 };
+	XRectangle rects[chunk_len];
+	unsigned char done[chunk_len];
+	unsigned long pixel;
+	size_t base, n, i, j;
+	int nrects;
+
+	if (!drw || !texts)
+		return;
+
+	for (base = 0; base < count; base += n) {
+		n = MIN(count - base, chunk_len);
+		memset(done, 0, sizeof(done));
+
+		/* one fill per background color instead of one per run */
+		for (i = 0; i < n; i++) {
+			if (done[i])
+				continue;
+			pixel = texts[base + i].scheme[texts[base + i].invert ? ColFg : ColBg].pixel;
+			nrects = 0;
+			for (j = i; j < n; j++) {
+				const DrwText *t = &texts[base + j];
+
+				if (done[j] || t->scheme[t->invert ? ColFg : ColBg].pixel != pixel)
+					continue;
+				done[j] = 1;
+				if (!t->w)
+					continue;
+				rects[nrects].x = (short)t->x;
+				rects[nrects].y = (short)t->y;
+				rects[nrects].width = (unsigned short)t->w;
+				rects[nrects].height = (unsigned short)t->h;
+				nrects++;
+			}
+			if (nrects) {
+				XSetForeground(drw->dpy, drw->gc, pixel);
+				XFillRectangles(drw->dpy, drw->drawable, drw->gc, rects, nrects);
+			}
+		}
+
+		for (i = 0; i < n; i++) {
+			const DrwText *t = &texts[base + i];
+
+			drw->scheme = t->scheme;
+			text_draw(drw, t->x, t->y, t->w, t->h, t->lpad, t->text, t->invert, 0);
+		}
+	}
+}
+
+static int
+text_draw(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lpad, const char *text, int invert, int fill)
+{
+	int ty, ellipsis_x = 0;
 	unsigned int tmpw, ew, ellipsis_w = 0, ellipsis_len;
-	XftDraw *d = NULL;
 	Fnt *usedfont, *curfont, *nextfont;
 	int utf8strlen, utf8charlen, render = x || y || w || h;
 	long utf8codepoint = 0;
@@ -363,10 +804,7 @@ drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lp
 	FcPattern *fcpattern;
 	FcPattern *match;
 	XftResult result;
-	int charexists = 0, overflow = 0;
-	/* keep track of a couple codepoints for which we have no match. */
-	enum { nomatches_len = 64 };
-	static struct { long codepoint[nomatches_len]; unsigned int idx; int padding;} nomatches;
+	int charexists = 0, overflow = 0, missing = 0;
 	static unsigned int ellipsis_width = 0;
 
 	if (!drw || (render && (!drw->scheme || !w)) || !text || !drw->fonts)
@@ -375,9 +813,10 @@ drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lp
 	if (!render) {
 		w = invert ? (uint)invert : (uint)~invert;
 	} else {
-		XSetForeground(drw->dpy, drw->gc, drw->scheme[invert ? ColFg : ColBg].pixel);
-		XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w, h);
-		d = XftDrawCreate(drw->dpy, drw->drawable, drw->visual, drw->cmap);
+		if (fill) {
+			XSetForeground(drw->dpy, drw->gc, drw->scheme[invert ? ColFg : ColBg].pixel);
+			XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w, h);
+		}
 		x += lpad;
 		w -= lpad;
 	}
@@ -391,34 +830,36 @@ drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lp
 		nextfont = NULL;
 		while (*text) {
 			utf8charlen = (int)utf8decode(text, &utf8codepoint, UTF_SIZ);
-			for (curfont = drw->fonts; curfont; curfont = curfont->next) {
-				charexists = charexists || XftCharExists(drw->dpy, curfont->xfont, (uint)utf8codepoint);
-				if (charexists) {
-					drw_font_getexts(curfont, text, (uint)utf8charlen, &tmpw, NULL);
-					if (ew + ellipsis_width <= w) {
-						/* keep track where the ellipsis still fits */
-						ellipsis_x = x + (int)ew;
-						ellipsis_w = w - ew;
-						ellipsis_len = (uint)utf8strlen;
-					}
-
-					if (ew + tmpw > w) {
-						overflow = 1;
-						/* called from drw_fontset_getwidth_clamp():
-						 * it wants the width AFTER the overflow
-						 */
-						if (!render)
-							x += tmpw;
-						else
-							utf8strlen = (int)ellipsis_len;
-					} else if (curfont == usedfont) {
-						utf8strlen += utf8charlen;
-						text += utf8charlen;
-						ew += tmpw;
-					} else {
-						nextfont = curfont;
-					}
-					break;
+			if (charexists) {
+				curfont = drw->fonts;
+			} else {
+				curfont = fontmap_font(drw, utf8codepoint, &missing);
+				charexists = curfont != NULL;
+			}
+			if (charexists) {
+				drw_font_getexts(curfont, text, (uint)utf8charlen, &tmpw, NULL);
+				if (ew + ellipsis_width <= w) {
+					/* keep track where the ellipsis still fits */
+					ellipsis_x = x + (int)ew;
+					ellipsis_w = w - ew;
+					ellipsis_len = (uint)utf8strlen;
+				}
+
+				if (ew + tmpw > w) {
+					overflow = 1;
+					/* called from drw_fontset_getwidth_clamp():
+					 * it wants the width AFTER the overflow
+					 */
+					if (!render)
+						x += tmpw;
+					else
+						utf8strlen = (int)ellipsis_len;
+				} else if (curfont == usedfont) {
+					utf8strlen += utf8charlen;
+					text += utf8charlen;
+					ew += tmpw;
+				} else {
+					nextfont = curfont;
 				}
 			}
 
@@ -431,14 +872,14 @@ drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lp
 		if (utf8strlen) {
 			if (render) {
 				ty = y + (int)((h - usedfont->h) / 2) + usedfont->xfont->ascent;
-				XftDrawStringUtf8(d, &drw->scheme[invert ? ColBg : ColFg],
+				XftDrawStringUtf8(drw->xftdraw, &drw->scheme[invert ? ColBg : ColFg],
 				                  usedfont->xfont, x, ty, (XftChar8 *)utf8str, utf8strlen);
 			}
 			x += ew;
 			w -= ew;
 		}
 		if (render && overflow)
-			drw_text(drw, ellipsis_x, y, ellipsis_w, h, 0, "...", invert);
+			text_draw(drw, ellipsis_x, y, ellipsis_w, h, 0, "...", invert, fill);
 
 		if (!*text || overflow) {
 			break;
@@ -450,11 +891,9 @@ drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lp
 			 * character must be drawn. */
 			charexists = 1;
 
-			for (i = 0; i < nomatches_len; ++i) {
-				/* avoid calling XftFontMatch if we know we won't find a match */
-				if (utf8codepoint == nomatches.codepoint[i])
-					goto no_match;
-			}
+			/* avoid calling XftFontMatch if we know we won't find a match */
+			if (missing)
+				goto no_match;
 
 			fccharset = FcCharSetCreate();
 			FcCharSetAddChar(fccharset, (uint)utf8codepoint);
@@ -478,21 +917,17 @@ drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lp
 			if (match) {
 				usedfont = xfont_create(drw, NULL, match);
 				if (usedfont && XftCharExists(drw->dpy, usedfont->xfont, (uint)utf8codepoint)) {
-					for (curfont = drw->fonts; curfont->next; curfont = curfont->next)
-						; /* NOP */
-					curfont->next = usedfont;
+					fontset_append(drw, usedfont);
+					fontmap_set(utf8codepoint, usedfont);
 				} else {
 					xfont_free(usedfont);
-					nomatches.codepoint[++nomatches.idx % nomatches_len] = utf8codepoint;
+					fontmap_set(utf8codepoint, NULL);
 no_match:
 					usedfont = drw->fonts;
 				}
 			}
 		}
 	}
-	if (d)
-		XftDrawDestroy(d);
-
 	return (int)((uint)x + (render ? w : 0));
 }
 
@@ -511,15 +946,73 @@ drw_map(Drw *drw, Window win, int x, int y, unsigned int w, unsigned int h)
 		return;
 
 	XCopyArea(drw->dpy, drw->drawable, win, drw->gc, x, y, w, h, x, y);
-	XSync(drw->dpy, False);
+}
+
+static unsigned long
+widthcache_hash(const char *text, size_t *len)
+{
+	unsigned long hash = 14695981039346656037UL;
+	const char *c;
+
+	for (c = text; *c; c++) {
+		hash ^= (unsigned char)*c;
+		hash *= 1099511628211UL;
+	}
+	*len = (size_t)(c - text);
+	return hash;
 }
 
 unsigned int
 drw_fontset_getwidth(Drw *drw, const char *text)
 {
+	WidthCacheEntry *set, *entry, *victim;
+	unsigned long hash;
+	unsigned int width;
+	size_t len;
+	int i;
+
 	if (!drw || !drw->fonts || !text)
 		return 0;
-	return (uint)drw_text(drw, 0, 0, 0, 0, 0, text, 0);
+
+	hash = widthcache_hash(text, &len);
+	if (len >= WidthCacheText)
+		return (uint)drw_text(drw, 0, 0, 0, 0, 0, text, 0);
+
+	set = drw->widths[hash % WidthCacheSets];
+	victim = &set[0];
+	for (i = 0; i < WidthCacheWays; i++) {
+		entry = &set[i];
+		if (entry->hash == hash && entry->len == len
+		    && entry->fonts == drw->fonts
+		    && entry->generation == fontset_generation
+		    && !memcmp(entry->text, text, len)) {
+			entry->used = ++drw->widths_tick;
+			return entry->width;
+		}
+		if (entry->used < victim->used)
+			victim = entry;
+	}
+
+	/* measuring may load a fallback font and bump the generation */
+	width = (uint)drw_text(drw, 0, 0, 0, 0, 0, text, 0);
+
+	victim->hash = hash;
+	victim->fonts = drw->fonts;
+	victim->generation = fontset_generation;
+	victim->width = width;
+	victim->used = ++drw->widths_tick;
+	victim->len = (uint)len;
+	memcpy(victim->text, text, len);
+	return width;
+}
+
+void
+drw_widthcache_clear(Drw *drw)
+{
+	if (!drw)
+		return;
+	memset(drw->widths, 0, WidthCacheSets * sizeof(*drw->widths));
+	drw->widths_tick = 0;
 }
 
 unsigned int
@@ -15,6 +15,19 @@ typedef struct Fnt {
 enum { ColFg, ColBg, ColBorder }; /* Clr scheme index */
 typedef XftColor Clr;
 
+/* text width cache, WidthCacheWays-way set associative with LRU eviction;
+ * strings longer than WidthCacheText bytes are measured every time */
+enum { WidthCacheSets = 64, WidthCacheWays = 4, WidthCacheText = 128 };
+typedef struct {
+	unsigned long hash;
+	const Fnt *fonts;
+	unsigned int generation;
+	unsigned int width;
+	unsigned int used;
+	unsigned int len;
+	char text[WidthCacheText];
+} WidthCacheEntry;
+
 typedef struct {
 	unsigned int w, h;
 	Display *dpy;
@@ -25,11 +38,24 @@ typedef struct {
 	Colormap cmap;
 	Drawable drawable;
 	Picture picture;
+	XftDraw *xftdraw;
 	GC gc;
 	Clr *scheme;
 	Fnt *fonts;
+	WidthCacheEntry (*widths)[WidthCacheWays];
+	unsigned int widths_tick;
 } Drw;
 
+/* one run for drw_texts, drawn like drw_text with the given scheme */
+typedef struct {
+	int x, y;
+	unsigned int w, h;
+	unsigned int lpad;
+	const char *text;
+	Clr *scheme;
+	int invert;
+} DrwText;
+
 /* Drawable abstraction */
 Drw *drw_create(Display *dpy, int screen, Window win, unsigned int w, unsigned int h, Visual *visual, unsigned int depth, Colormap cmap);
 void drw_resize(Drw *drw, unsigned int w, unsigned int h);
@@ -41,6 +67,9 @@ void drw_fontset_free(Fnt* set);
 unsigned int drw_fontset_getwidth(Drw *drw, const char *text);
 unsigned int drw_fontset_getwidth_clamp(Drw *drw, const char *text, unsigned int n);
 void drw_font_getexts(Fnt *font, const char *text, unsigned int len, unsigned int *w, unsigned int *h);
+void drw_widthcache_clear(Drw *drw);
+int drw_fontmap_load(Drw *drw, const char *path);
+int drw_fontmap_save(Drw *drw, const char *path);
 
 /* Colorscheme abstraction */
 void drw_clr_create(Drw *drw, Clr *dest, const char *clrname, unsigned int alpha);
@@ -59,6 +88,7 @@ Picture drw_picture_create_resized(Drw *drw, char *src, unsigned int src_w, unsi
 /* Drawing functions */
 void drw_rect(Drw *drw, int x, int y, unsigned int w, unsigned int h, int filled, int invert);
 int drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lpad, const char *text, int invert);
+void drw_texts(Drw *drw, const DrwText *texts, size_t count);
 void drw_pic(Drw *drw, int x, int y, unsigned int w, unsigned int h, Picture pic);
 
 /* Map functions */
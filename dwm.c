@@ -22,6 +22,7 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <locale.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -31,30 +32,50 @@
 #include <string.h>
 #include <unistd.h>
 #include <limits.h>
+#include <poll.h>
 #include <stdint.h>
 #include <time.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/wait.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 #include <X11/cursorfont.h>
 #include <X11/keysym.h>
 #include <X11/Xatom.h>
 #include <X11/Xlib.h>
+#include <X11/Xlib-xcb.h>
 #include <X11/Xproto.h>
 #include <X11/Xutil.h>
+#include <xcb/xcb.h>
 
 #ifdef XINERAMA
 #include <X11/extensions/Xinerama.h>
 #endif /* XINERAMA */
+#ifdef XRANDR
+#include <X11/extensions/Xrandr.h>
+#endif /* XRANDR */
 
 #include <X11/Xft/Xft.h>
 
 #include "drw.h"
+#include "layout.h"
+#include "match.h"
+#include "trace.h"
 
+typedef int32_t int32;
 typedef uint8_t uint8;
 typedef uint32_t uint32;
+typedef uint64_t uint64;
 typedef unsigned int uint;
 typedef unsigned long ulong;
 typedef unsigned char uchar;
+#if defined(__GNUC__) || defined(__clang__)
+typedef uint32 uint32x4 __attribute__((vector_size(16)));
+#endif
 
 #define BUTTONMASK (ButtonPressMask|ButtonReleaseMask)
 #define CLEANMASK(mask)         \
@@ -66,10 +87,41 @@ typedef unsigned char uchar;
 #define PAUSE_MILIS_AS_NANOS(X) ((X)*1000*1000)
 
 #define TAG_DISPLAY_SIZE 32
+#define EVENT_BATCH_SIZE 256
+#define EVENT_COMPRESS_SLOTS (2*EVENT_BATCH_SIZE)
+#define SNAPSHOT_ENV "DWM_SNAPSHOT_FD"
+#define SNAPSHOT_MAGIC 0x534D5744u
+#define SNAPSHOT_VERSION 1u
+#define BAR_HASH_SEED 0xCBF29CE484222325u
+#define NAME_SIZE 256
+#define CLASS_SIZE 64
+/* property lengths in 32 bit units */
+/* enough for the small images most clients list first */
+#define ICON_PREFIX_LENGTH (2 + 64*64)
+/* never more of _NET_WM_ICON than this, about 512 KiB */
+#define ICON_MAX_LENGTH (1u << 17)
+#define ICON_MAX_DIMENSION 16384
+#define ICON_MAX_IMAGES 64
+#define SIZE_HINTS_LENGTH 18
+#define SIZE_HINTS_OLD_LENGTH 15
+#define WM_HINTS_LENGTH 9
 #define ALT_TAB_GRAB_TRIES 10
+#define DRAG_FRAME_MILIS (1000 / 60) /* without a RandR refresh rate */
+#define GEOMETRY_SETTLE_MILIS 250  /* RandR changes come in bursts */
 #define STATUS_BUFFER_SIZE 200
 #define STATUS_MAX_BLOCKS 40
 #define STATUS_PROGRAM "dwmblocks2"
+#define STATUS_PID_PROPERTY "_DWM_STATUS_PID"
+#define STATUS_BLOCK_SIZE 64
+#define STATUS_SOCKET_ENV "DWM_STATUS_SOCKET"
+#define NOTIFY_SOURCES 16
+#define NOTIFY_BURST 3
+#define NOTIFY_WINDOW_SECONDS 10
+#define NOTIFY_BUS_MESSAGE_SIZE 2048
+#define NOTIFY_TIMEOUT_MILIS 2000
+#define NOTIFY_REPLY_MILIS 1000
+#define STATS_BUCKETS 24
+#define STATS_PROPERTY "_DWM_STATS"
 #define DWM_BAR_SEPARATOR ((char) 0x01)
 
 #define MAX(A, B)               ((A) > (B) ? (A) : (B))
@@ -91,13 +143,39 @@ typedef unsigned char uchar;
 #define DWM_DEBUG(...)
 #endif
 
+#ifdef STATS
+#define STATS_COUNT(C) (stats_counters[C] += 1)
+#else
+#define STATS_COUNT(C)
+#endif
+
 enum { NET_SUPPORTED, NET_WM_NAME, NET_WM_ICON, NET_WM_STATE,
        NET_SUPPORTING_WM_CHECK, NET_WM_STATE_FULLSCREEN, NET_ACTIVE_WINDOW,
        NET_WM_WINDOW_TYPE, NET_WM_WINDOW_TYPE_DIALOG, NET_CLIENT_LIST,
-       NET_CLIENT_INFO, NET_LAST };
+       NET_CLIENT_LIST_STACKING, NET_CLIENT_INFO, NET_LAST };
 enum { WM_PROTOCOLS, WM_DELETE_WINDOW, WM_STATE, WM_TAKE_FOCUS, WM_LAST };
 
 enum { BarBottom, BarTop };
+/* properties read by client_new() */
+enum {
+    PropertyIcon,
+    PropertyNetName,
+    PropertyName,
+    PropertyClass,
+    PropertyTransient,
+    PropertyState,
+    PropertyWindowType,
+    PropertyNormalHints,
+    PropertyHints,
+    PropertyClientInfo,
+    PropertyLast
+};
+
+/* file descriptors watched by the main loop */
+enum { FdDisplay, FdStatusPid, FdStatusSocket, FdLast };
+enum { NotifyBusBroken, NotifyBusNothing, NotifyBusError, NotifyBusReturn };
+
+enum { DirtyArrange = 1 << 0, DirtyRestack = 1 << 1, DirtyBars = 1 << 2 };
 enum { CursorNormal, CursorResize, CursorMove, CursorLast };
 enum { SchemeNormal, SchemeInverse, SchemeSelected, SchemeUrgent };
 enum { ClickBarTags, ClickBarLayoutSymbol, ClickBarStatus, ClickBarTitle,
@@ -120,32 +198,62 @@ typedef struct {
 
 typedef struct Monitor Monitor;
 typedef struct Client Client;
+/* What layouts, restacking and visibility checks read, one cache line
+ * per client. The rest of a client is its ClientCold, see client_cold(). */
 struct Client {
-    char name[256];
     Client *next;
     Client *stack_next;
-    Client *all_next;
     Monitor *monitor;
-    Picture icon;
-    float min_aspect, max_aspect;
+    Window window;
 
     int x, y, w, h;
-    int stored_fx, stored_fy, stored_fw, stored_fh;
-    int old_x, old_y, old_w, old_h;
-    int base_w, base_h;
-    int increment_w, increment_h;
-    int max_w, max_h, min_w, min_h;
-    int border_pixels;
-    int old_border_pixels;
     uint tags;
+    int border_pixels;
+    int window_border_pixels;
+
+    bool is_floating : 1;
+    bool is_fullscreen : 1;
+    bool is_fake_fullscreen : 1;
+    bool is_shown : 1;
+    bool place_again : 1;
+    bool is_urgent : 1;
+    bool is_fixed : 1;
+    bool hintsvalid : 1;
+    bool has_hints : 1;     /* some size hint can change a tiled size */
+};
+
+typedef struct ClientCold {
+    Client *all_next;
+    SizeHints hints;
+    char name[NAME_SIZE];
+    char class[CLASS_SIZE];
+    char instance[CLASS_SIZE];
 
+    Picture icon;
     uint icon_width, icon_height;
 
-    bool hintsvalid;
-    bool is_fixed, is_floating, is_urgent;
-    Window window;
+    int stored_fx, stored_fy, stored_fw, stored_fh;
+    int old_x, old_y, old_w, old_h;
+    int old_border_pixels;
     bool never_focus, old_state;
-    bool is_fullscreen, is_fake_fullscreen;
+} ClientCold;
+
+/* Clients come from slabs aligned to their size, so that a client finds
+ * its slab, and so its ClientCold, from its own address. Released ones
+ * are kept on a free list through their next pointer. */
+#define CLIENT_SLAB_SIZE 32768
+#define CLIENT_SLAB_CLIENTS \
+    ((CLIENT_SLAB_SIZE - sizeof(void *)) \
+     / (sizeof(Client) + sizeof(ClientCold)))
+typedef struct ClientSlab ClientSlab;
+struct ClientSlab {
+    Client clients[CLIENT_SLAB_CLIENTS];
+    ClientCold colds[CLIENT_SLAB_CLIENTS];
+    ClientSlab *next;
+};
+struct ClientFits {
+    char hot[sizeof(Client) <= 64 ? 1 : -1];
+    char slab[sizeof(ClientSlab) <= CLIENT_SLAB_SIZE ? 1 : -1];
 };
 
 typedef struct {
@@ -161,6 +269,9 @@ typedef struct {
 } Layout;
 
 typedef struct Pertag Pertag;
+typedef struct TagBuckets TagBuckets;
+typedef struct Bar Bar;
+typedef struct SnapshotMonitor SnapshotMonitor;
 struct Monitor {
     char layout_symbol[16];
     const Layout *layout[2];
@@ -170,6 +281,7 @@ struct Monitor {
     Client *stack;
     Monitor *next;
     Pertag *pertag;
+    TagBuckets *buckets;
 
     uint tagset[2];
 
@@ -183,11 +295,19 @@ struct Monitor {
 
     uint selected_tags;
     uint lay_i;
+    uint dirty;
+    uint frame_milis;   /* between two steps of a mouse drag */
+#ifdef XRANDR
+    RROutput output;    /* the output it shows, None under Xinerama */
+#endif /* XRANDR */
+    bool geometry_changed;
 
     bool show_top_bar;
     bool show_bottom_bar;
+    bool shown_floating;
     Window top_bar_window;
     Window bottom_bar_window;
+    Bar *bars;
 };
 
 typedef struct {
@@ -207,18 +327,134 @@ typedef struct BlockSignal {
     int max_x;
     int signal;
     int text_i;
+    int text_pixels;
+    int scheme;
+    bool dirty;
+    uint64 hash;
 } BlockSignal;
 
+/* block as last sent over the status socket */
+typedef struct StatusBlock {
+    char text[STATUS_BLOCK_SIZE];
+    int signal;
+    int scheme;
+    bool used;
+} StatusBlock;
+
+typedef struct BarSegment {
+    int x;
+    int w;
+    uint64 hash;
+} BarSegment;
+
 typedef struct StatusBar {
     char text[STATUS_BUFFER_SIZE*2];
+    uint64 hash;
     int pixels;
     int number_blocks;
     BlockSignal blocks_signal[STATUS_MAX_BLOCKS];
 } StatusBar;
 
+/* window found by scan_windows_once(), with its queries in flight */
+typedef struct ScanWindow {
+    xcb_get_window_attributes_cookie_t attributes;
+    xcb_get_geometry_cookie_t geometry;
+    xcb_get_property_cookie_t transient;
+    xcb_get_property_cookie_t state;
+    XWindowAttributes window_attributes;
+    bool adopt;
+    bool is_transient;
+} ScanWindow;
+
+/* State carried across a restart, written by snapshot_write() to a file
+ * whose descriptor is passed to the new process in SNAPSHOT_ENV. It is
+ * a header, one SnapshotMonitor per monitor and then one SnapshotClient
+ * per client, grouped by monitor in list order. */
+typedef struct SnapshotHeader {
+    uint32 magic;
+    uint32 version;
+    uint32 number_tags;
+    uint32 number_layouts;
+    uint32 number_monitors;
+    uint32 number_clients;
+    int32 live_monitor;
+} SnapshotHeader;
+
+typedef struct SnapshotClient {
+    uint32 window;
+    int32 monitor;
+    uint32 tags;
+    uint32 stack_index;
+    int32 x, y, w, h;
+    int32 stored_fx, stored_fy, stored_fw, stored_fh;
+    uint8 is_floating;
+    uint8 old_state;
+} SnapshotClient;
+
+/* a Picture shared by every client showing the same icon */
+typedef struct IconEntry {
+    struct IconEntry *next;
+    uint64 hash;
+    uint64 check;       /* second, unrelated hash of the same pixels */
+    Picture picture;
+    uint32 source_width, source_height;
+    uint icon_width, icon_height;
+    uint references;
+} IconEntry;
+
+/* position of one image inside _NET_WM_ICON, in 32 bit units */
+typedef struct IconImage {
+    uint32 offset;
+    uint32 w, h;
+} IconImage;
+
+/* a D-Bus message being marshalled, in host byte order */
+typedef struct NotifyBuffer {
+    uchar data[NOTIFY_BUS_MESSAGE_SIZE];
+    uint32 length;
+    bool overflow;
+} NotifyBuffer;
+
+typedef struct WindowEntry {
+    Window window;
+    void *pointer;
+} WindowEntry;
+
+/* open addressing (linear probing) table keyed by XID,
+ * capacity is always a power of two */
+typedef struct WindowTable {
+    WindowEntry *entries;
+    uint capacity;
+    uint count;
+} WindowTable;
+
+/* candidates of an alt-tab in most recently used order: the stack of
+ * the live monitor, then those of the others */
+typedef struct AltTab {
+    Client **clients;
+    int number_clients;
+    int capacity;
+    int selected;
+    bool active;
+} AltTab;
+
+#ifdef XRANDR
+typedef struct RandrOutput {
+    RROutput output;
+    int x, y, w, h;
+    uint milis;
+} RandrOutput;
+#endif /* XRANDR */
+
 static StatusBar status_top = {0};
 static StatusBar status_bottom = {0};
 static int status_signal;
+static pid_t status_pid = -1;
+static StatusBlock status_blocks[2][STATUS_MAX_BLOCKS];
+static char status_socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static bool status_socket_active = false;
+static time_t status_pid_lookup;
+static Atom status_pid_atom;
 
 static void user_alt_tab(const Arg *);
 static void user_aspect_resize(const Arg *);
@@ -251,6 +487,9 @@ static int handler_xerror_start(Display *, XErrorEvent *);
 static void handler_button_press(XEvent *);
 static void handler_client_message(XEvent *);
 static void handler_configure_notify(XEvent *);
+#ifdef XRANDR
+static void handler_randr_notify(XEvent *);
+#endif /* XRANDR */
 static void handler_configure_request(XEvent *);
 static void handler_destroy_notify(XEvent *);
 static void handler_enter_notify(XEvent *);
@@ -264,6 +503,10 @@ static void handler_others(XEvent *);
 static void handler_property_notify(XEvent *);
 static void handler_unmap_notify(XEvent *);
 
+static void alt_tab_finish(void);
+static void alt_tab_gather(Window);
+static void alt_tab_step(int);
+
 static Atom client_get_atom_property(Client *, Atom);
 static Client *client_next_tiled(Client *);
 static bool client_is_visible(Client *);
@@ -271,6 +514,7 @@ static bool client_send_event(Client *, Atom);
 static int client_apply_size_hints(Client *, int *, int *, int *, int *, bool);
 static int client_pixels_height(Client *);
 static int client_pixels_width(Client *);
+static int client_window_border(Client *);
 static void client_apply_rules(Client *);
 static void client_attach(Client *);
 static void client_attach_stack(Client *);
@@ -280,10 +524,23 @@ static void client_detach(Client *);
 static void client_detach_stack(Client *);
 static void client_focus(Client *);
 static void client_free_icon(Client *);
+static uint64 icon_hash(const uint32 *, uint32, uint32, uint32, uint64 *);
+static void icon_premultiply(uint32 *, uint32);
+static void icon_release(Picture);
 static void client_grab_buttons(Client *, bool);
 static void client_new(Window, XWindowAttributes *);
 static void client_pop(Client *);
 static void client_resize(Client *, int, int, int, int, bool);
+static void client_resize_commit(Client *, int, int, int, int);
+static Client *client_alloc(void);
+static ClientCold *client_cold(Client *);
+static void client_release(Client *);
+static void client_list_add(Window);
+static void client_list_remove(Window);
+static void client_list_publish(bool);
+static void client_drag_move(Client *, int, int);
+static void client_drag_resize(Client *, int, int);
+static void client_tags_changed(Client *);
 static void client_resize_apply(Client *, int, int, int, int);
 static void client_send_monitor(Client *, Monitor *);
 static void client_set_client_state(Client *, long);
@@ -291,12 +548,23 @@ static void client_set_client_tag_prop(Client *);
 static void client_set_focus(Client *);
 static void client_set_fullscreen(Client *, bool);
 static void client_set_urgent(Client *, bool);
-static void client_show_hide(Client *);
 static void client_unfocus(Client *, bool);
 static void client_unmanage(Client *, int);
+static void client_read_class(Client *, xcb_get_property_reply_t *);
+static void client_read_icon(Client *, xcb_get_property_reply_t *);
+static void client_load_icon(Client *, xcb_get_property_reply_t *);
+static void client_read_size_hints(Client *, xcb_get_property_reply_t *);
+static void client_read_title(Client *,
+                              xcb_get_property_reply_t *,
+                              xcb_get_property_reply_t *);
+static void client_read_window_type(Client *,
+                                    xcb_get_property_reply_t *,
+                                    xcb_get_property_reply_t *);
+static void client_read_wm_hints(Client *, xcb_get_property_reply_t *);
 static void client_update_icon(Client *);
 static void client_update_size_hints(Client *);
 static void client_update_title(Client *);
+static void client_update_class(Client *);
 static void client_update_window_type(Client *);
 static void client_update_wm_hints(Client *);
 
@@ -304,43 +572,123 @@ static void monitor_arrange(Monitor *);
 static void monitor_arrange_monitor(Monitor *);
 static void monitor_cleanup_monitor(Monitor *);
 static void monitor_draw_bars(Monitor *);
+static void monitor_draw_bottom_bar(Monitor *);
+static void monitor_draw_top_bar(Monitor *);
 static void monitor_layout_columns(Monitor *);
 static void monitor_layout_grid(Monitor *);
 static void monitor_layout_monocle(Monitor *);
 static void monitor_layout_tile(Monitor *);
+static void monitor_run_layout(Monitor *, LayoutFunction *);
+static void monitor_show_hide(Monitor *);
+static TagBuckets *monitor_tag_buckets(Monitor *);
 static void monitor_restack(Monitor *);
+static void monitor_apply_stack(Monitor *);
+static void monitor_set_dirty(Monitor *, uint);
 static void monitor_update_bar_position(Monitor *);
+#ifdef XRANDR
+static uint monitor_mode_milis(XRRScreenResources *, RRMode);
+static void monitor_update_frame_milis(void);
+#endif /* XRANDR */
 static void monitor_focus(Monitor *, bool);
 static void monitor_restore_pertag(Monitor *, Pertag *);
 
 static Monitor *create_monitor(void);
 static Monitor *direction_to_monitor(int);
+static Monitor *num_to_monitor(int);
 static Monitor *rectangle_to_monitor(int, int, int, int);
 
 static Monitor *window_to_monitor(Window);
 static Client *window_to_client(Window);
+static void *window_table_lookup(WindowTable *, Window);
+static void window_table_insert(WindowTable *, Window, void *);
+static void window_table_remove(WindowTable *, Window);
+static xcb_get_property_cookie_t window_property_request(Window, Atom,
+                                                         Atom, uint32);
+static xcb_get_property_reply_t *window_property_reply(
+                                    xcb_get_property_cookie_t);
+static Atom window_read_atom(xcb_get_property_reply_t *);
+static int window_read_text(xcb_get_property_reply_t *, char *, uint);
 static int window_text_property(Window, Atom, char *, uint);
-static long window_state(Window);
+
+static void bar_begin(Bar *, int);
+static void bar_end(Bar *, Window, int);
+static uint64 bar_hash(uint64, const void *, size_t);
+static void bar_invalidate(Bar *);
+static bool bar_segment(Bar *, BarSegment *, int, int, uint64);
 
 static void *xcalloc(size_t, size_t);
 static void error(const char *, char *, ...);
+static int notify_bus_open(const char *, size_t);
+static int notify_bus_connect(void);
+static uint32 notify_bus_get32(const uchar *, bool);
+static int notify_bus_parse(uint *, uint32 *);
+static int notify_bus_read(int, uint32, int);
+static void notify_utf8_clean(char *);
+static void notify_bus_put(NotifyBuffer *, const void *, uint32);
+static void notify_bus_align(NotifyBuffer *, uint32);
+static void notify_bus_uint32(NotifyBuffer *, uint32);
+static void notify_bus_string(NotifyBuffer *, const char *);
+static void notify_bus_signature(NotifyBuffer *, const char *);
+static void notify_bus_field(NotifyBuffer *, uchar, char, const char *);
+static bool notify_bus_call(int, uint32, const char *, const char *,
+                            const char *, const char *, const char *,
+                            NotifyBuffer *);
+static bool notify_bus_notify(int, uint32, const char *, const char *);
+static void notify_helper_exec(const char *, const char *);
+static void notify_helper_run(int);
+static bool notify_helper_start(void);
+static void notify_send(const char *, char *, char *);
 static void set_layout(const Layout *);
 static int get_root_pointer(int *, int *);
 static int get_text_pixels(char *);
 static int update_geometry(void);
+static void update_geometry_apply(bool);
+#ifdef XRANDR
+static bool update_geometry_has_output(RandrOutput *, int, RROutput);
+static int update_geometry_randr(void);
+static int update_geometry_timeout(void);
+#endif /* XRANDR */
+static Drw *create_bar_drw(int);
 static void configure_bars_windows(void);
 static void draw_bars(void);
-static void draw_status_text(StatusBar *, int);
-static void focus_direction(int);
-static void focus_next(bool);
+static int event_compress(XEvent *, int);
+static void event_drain_motion(XEvent *);
+static Bool event_is_early_motion(Display *, XEvent *, XPointer);
+static void event_dispatch(XEvent *);
+static void event_loop(void);
+static int event_read_batch(XEvent *, int);
+static void flush_dirty_monitors(void);
+static bool font_cache_path(char *, size_t);
+static void draw_status_text(Bar *, StatusBar *, int);
 static void grab_keys(void);
+static void rules_compile(void);
+static void rules_match(const char *, const char *, const char *, uint64 *);
+static void run_action(void (*)(const Arg *), const Arg *);
 static void scan_windows_once(void);
 static void setup_once(void);
-static void status_get_signal_number(BlockSignal *, int);
-static void status_parse_text(StatusBar *);
+static void snapshot_apply(SnapshotHeader *, SnapshotMonitor *,
+                           SnapshotClient *);
+static int snapshot_compare_stack(const void *, const void *);
+static const Layout *snapshot_layout(uint32);
+static bool snapshot_restore(void);
+static void snapshot_write(void);
+static pid_t status_find_pid(void);
+static void status_forget_pid(void);
+static void status_get_signal_number(StatusBar *, int);
+static pid_t status_program_pid(void);
+static bool status_socket_build(StatusBar *, StatusBlock *);
+static void status_socket_close(void);
+static int status_socket_message(char *);
+static void status_socket_open(void);
+static void status_socket_read(void);
+static void status_measure_block(StatusBar *, int, char *, int);
+static bool status_parse_text(StatusBar *, const char *);
 static void toggle_bar(int);
+static void trace_flush(void);
+static void trace_open(void);
+static void trace_write(uint32, const void *, size_t);
 static void update_numlock_mask(void);
-static void status_update(void);
+static bool status_update(void);
 static void view_tag(uint);
 
 static const char broken[] = "broken";
@@ -353,6 +701,34 @@ static uint bar_height;
 static int text_padding;
 static int (*xerrorxlib)(Display *, XErrorEvent *);
 static uint numlock_mask = 0;
+/* error() notifications: one helper process keeps a connection to the
+ * session bus and sends a Notify call for each packet it receives, while
+ * every function may only raise NOTIFY_BURST distinct messages per
+ * NOTIFY_WINDOW_SECONDS */
+typedef struct NotifySource {
+    const char *function;
+    time_t window_start;
+    int sent;
+    int suppressed;
+    uint64 hashes[NOTIFY_BURST];    /* of the sent ones, this window */
+} NotifySource;
+static NotifySource notify_sources[NOTIFY_SOURCES];
+static int notify_fd = -1;
+/* what the helper got from the bus and has not parsed yet */
+static struct {
+    uchar data[4*NOTIFY_BUS_MESSAGE_SIZE];
+    uint32 length;
+} notify_bus_input;
+
+static struct pollfd poll_fds[FdLast] = {
+    [FdStatusPid] = { .fd = -1 },
+    [FdStatusSocket] = { .fd = -1 },
+};
+static ulong configures_skipped = 0;
+
+static int trace_fd = -1;
+static size_t trace_used = 0;
+static uchar trace_buffer[1 << 16];
 
 static void (*handlers[LASTEvent]) (XEvent *) = {
     [ButtonPress] = handler_button_press,
@@ -394,6 +770,7 @@ static void (*handlers[LASTEvent]) (XEvent *) = {
 static Atom wm_atoms[WM_LAST];
 static Atom net_atoms[NET_LAST];
 static Display *display;
+static xcb_connection_t *xcb_connection;
 static Visual *visual;
 static Colormap color_map;
 static Window root;
@@ -401,6 +778,7 @@ static Window wm_check_window;
 static int depth;
 
 static bool dwm_restart = false;
+static char font_cache[PATH_MAX];
 static bool dwm_running = true;
 
 static Cur *cursor[CursorLast];
@@ -410,6 +788,17 @@ static Drw *drw;
 static Monitor *monitors;
 static Monitor *live_monitor;
 static Client *all_clients = NULL;
+static WindowTable client_windows = {0};
+static WindowTable bar_windows = {0};
+static AltTab alt_tab = {0};
+static ClientSlab *client_slabs = NULL;
+static Client *client_free_list = NULL;
+#ifdef XRANDR
+static int randr_event_base = -1;
+static struct timespec geometry_deadline;
+static bool geometry_pending = false;
+#endif /* XRANDR */
+static IconEntry *icons = NULL;
 
 #include "config.h"
 
@@ -424,11 +813,222 @@ struct Pertag {
     bool bottom_bars[LENGTH(tags) + 1];
 };
 
-static int tags_widths[LENGTH(tags)];
+/* config.h rules compiled by rules_compile(): which rules match a window
+ * is found with one pass over each of its class, instance and title. */
+enum { RuleClass, RuleInstance, RuleTitle, RuleFieldLast };
+#define RULE_WORDS ((LENGTH(rules) + 63) / 64)
+static struct {
+    Matcher *matchers[RuleFieldLast];
+    uint64 unset[RuleFieldLast][RULE_WORDS]; /* rules not asking for it */
+} rule_index;
+
+/* keys[] by keycode, built by grab_keys(): the bindings of keycode k are
+ * bindings[start[k]] up to bindings[start[k + 1]], in keys[] order, and
+ * masks holds the CLEANMASK of each keys[] modifier. */
+static struct {
+    int start[256 + 1];
+    int *bindings;
+    uint masks[LENGTH(keys)];
+} key_table;
+
+/* _NET_CLIENT_LIST in mapping order, kept here and written to the root
+ * window with one replace per flush instead of one append per window.
+ * stacking is the last _NET_CLIENT_LIST_STACKING written, bottom up. */
+static struct {
+    Window *windows;
+    Window *stacking;
+    int number_windows;
+    int number_stacking;
+    int capacity;
+    bool dirty;
+} client_list;
+
+/* What layouts and the bar want to know about the tags of a monitor,
+ * rebuilt by monitor_tag_buckets() only after client_tags_changed() or
+ * a change of the viewed tags, instead of on every arrange and draw. */
+struct TagBuckets {
+    Client **visible;   /* clients on the viewed tags, in list order */
+    int number_visible;
+    int number_tiled;   /* of those, the ones not floating */
+    int capacity;
+    uint tagset;        /* viewed tags when visible was gathered */
+    uint urgent;        /* tags with an urgent client */
+    Client *icon_owners[LENGTH(tags)];
+    const char *masters_names[LENGTH(tags)];
+    bool valid;
+};
+
+/* what a bar pixmap currently shows, so that a redraw only paints and
+ * copies the segments whose position or content changed. Segments of a
+ * bar never overlap and together cover its whole width. */
+struct Bar {
+    Drw *drw;
+    BarSegment tags[LENGTH(tags)];
+    BarSegment layout_symbol;
+    BarSegment title;
+    BarSegment fills[2];
+    BarSegment status[STATUS_MAX_BLOCKS];
+    int damage_x0;
+    int damage_x1;
+    bool overlapped;    /* tag labels ran into the status last frame */
+};
+
+struct SnapshotMonitor {
+    int32 num;
+    uint32 tagset[2];
+    uint32 selected_tags;
+    uint32 lay_i;
+    uint32 layouts[2];
+    float master_fact;
+    int32 number_masters;
+    uint32 selected_client;
+    uint8 show_top_bar;
+    uint8 show_bottom_bar;
+    /* layouts are stored as indexes into layouts[] */
+    uint32 pertag_layouts[LENGTH(tags) + 1][2];
+    int32 pertag_number_masters[LENGTH(tags) + 1];
+    float pertag_master_facts[LENGTH(tags) + 1];
+    uint32 pertag_selected_layouts[LENGTH(tags) + 1];
+    uint32 pertag_tag;
+    uint32 pertag_old_tag;
+    uint8 pertag_top_bars[LENGTH(tags) + 1];
+    uint8 pertag_bottom_bars[LENGTH(tags) + 1];
+};
 
 /* compile-time check if all tags fit into an uint bit array. */
 struct NumTags { char limitexceeded[LENGTH(tags) > 31 ? -1 : 1]; };
 
+#ifdef STATS
+/* Built with -DSTATS: every handler and user action is timed into
+ * power of two histograms, bucket i counting calls that took less than
+ * 2^i microseconds, and round trips and expensive steps are counted.
+ * kill -USR1 publishes them as text in the _DWM_STATS root property. */
+typedef struct StatsHistogram {
+    uint64 count;
+    uint64 total_ns;
+    uint64 max_ns;
+    uint32 buckets[STATS_BUCKETS];
+} StatsHistogram;
+
+enum { StatsXSync, StatsXGetWindowAttributes, StatsXGetTransientForHint,
+       StatsXGetWMProtocols, StatsXGetWMHints, StatsXQueryPointer,
+       StatsXGetWindowProperty, StatsXGetClassHint, StatsXcbReply,
+       StatsArrange, StatsRestack, StatsDrawBars, StatsFlush, StatsLast };
+
+static const char *stats_counter_names[StatsLast] = {
+    [StatsXSync] = "XSync",
+    [StatsXGetWindowAttributes] = "XGetWindowAttributes",
+    [StatsXGetTransientForHint] = "XGetTransientForHint",
+    [StatsXGetWMProtocols] = "XGetWMProtocols",
+    [StatsXGetWMHints] = "XGetWMHints",
+    [StatsXQueryPointer] = "XQueryPointer",
+    [StatsXGetWindowProperty] = "XGetWindowProperty",
+    [StatsXGetClassHint] = "XGetClassHint",
+    [StatsXcbReply] = "xcb_reply",
+    [StatsArrange] = "arrange",
+    [StatsRestack] = "restack",
+    [StatsDrawBars] = "draw_bars",
+    [StatsFlush] = "flush",
+};
+
+static const char *stats_event_names[LASTEvent] = {
+    [ButtonPress] = "ButtonPress",
+    [CirculateNotify] = "CirculateNotify",
+    [CirculateRequest] = "CirculateRequest",
+    [ClientMessage] = "ClientMessage",
+    [ColormapNotify] = "ColormapNotify",
+    [ConfigureNotify] = "ConfigureNotify",
+    [ConfigureRequest] = "ConfigureRequest",
+    [CreateNotify] = "CreateNotify",
+    [DestroyNotify] = "DestroyNotify",
+    [EnterNotify] = "EnterNotify",
+    [Expose] = "Expose",
+    [FocusIn] = "FocusIn",
+    [FocusOut] = "FocusOut",
+    [GenericEvent] = "GenericEvent",
+    [GraphicsExpose] = "GraphicsExpose",
+    [GravityNotify] = "GravityNotify",
+    [KeyPress] = "KeyPress",
+    [KeymapNotify] = "KeymapNotify",
+    [LeaveNotify] = "LeaveNotify",
+    [MapNotify] = "MapNotify",
+    [MapRequest] = "MapRequest",
+    [MappingNotify] = "MappingNotify",
+    [MotionNotify] = "MotionNotify",
+    [NoExpose] = "NoExpose",
+    [PropertyNotify] = "PropertyNotify",
+    [ReparentNotify] = "ReparentNotify",
+    [ResizeRequest] = "ResizeRequest",
+    [SelectionClear] = "SelectionClear",
+    [SelectionNotify] = "SelectionNotify",
+    [SelectionRequest] = "SelectionRequest",
+    [UnmapNotify] = "UnmapNotify",
+    [VisibilityNotify] = "VisibilityNotify",
+};
+
+#define STATS_ACTION(F) { F, #F }
+static const struct {
+    void (*function)(const Arg *);
+    const char *name;
+} stats_action_names[] = {
+    STATS_ACTION(user_alt_tab),
+    STATS_ACTION(user_aspect_resize),
+    STATS_ACTION(user_focus_monitor),
+    STATS_ACTION(user_focus_stack),
+    STATS_ACTION(user_focus_urgent),
+    STATS_ACTION(user_kill_client),
+    STATS_ACTION(user_more_masters),
+    STATS_ACTION(user_mouse_move),
+    STATS_ACTION(user_mouse_resize),
+    STATS_ACTION(user_promote_to_master),
+    STATS_ACTION(user_quit_dwm),
+    STATS_ACTION(user_set_layout),
+    STATS_ACTION(user_set_master_fact),
+    STATS_ACTION(user_signal_status_bar),
+    STATS_ACTION(user_spawn),
+    STATS_ACTION(user_tag),
+    STATS_ACTION(user_tag_monitor),
+    STATS_ACTION(user_toggle_bar),
+    STATS_ACTION(user_toggle_floating),
+    STATS_ACTION(user_toggle_fullscreen),
+    STATS_ACTION(user_toggle_tag),
+    STATS_ACTION(user_toggle_view),
+    STATS_ACTION(user_view_tag),
+    STATS_ACTION(user_window_view),
+};
+#undef STATS_ACTION
+
+static uint64 stats_counters[StatsLast];
+static StatsHistogram stats_handlers[LASTEvent];
+static StatsHistogram stats_actions[LENGTH(stats_action_names)];
+static volatile sig_atomic_t stats_requested = 0;
+
+static uint64 stats_now(void);
+static void stats_publish(void);
+static void stats_record(StatsHistogram *, uint64);
+static void stats_signal(int);
+
+/* synchronous requests, counted wherever they are made */
+#define XSync(D, B) \
+    (STATS_COUNT(StatsXSync), XSync(D, B))
+#define XGetWindowAttributes(D, W, A) \
+    (STATS_COUNT(StatsXGetWindowAttributes), XGetWindowAttributes(D, W, A))
+#define XGetTransientForHint(D, W, T) \
+    (STATS_COUNT(StatsXGetTransientForHint), XGetTransientForHint(D, W, T))
+#define XGetWMProtocols(D, W, P, N) \
+    (STATS_COUNT(StatsXGetWMProtocols), XGetWMProtocols(D, W, P, N))
+#define XGetWMHints(D, W) \
+    (STATS_COUNT(StatsXGetWMHints), XGetWMHints(D, W))
+#define XQueryPointer(D, W, R, C, RX, RY, X, Y, M) \
+    (STATS_COUNT(StatsXQueryPointer), \
+     XQueryPointer(D, W, R, C, RX, RY, X, Y, M))
+#define XGetWindowProperty(D, W, P, O, L, DEL, T, AT, AF, N, B, V) \
+    (STATS_COUNT(StatsXGetWindowProperty), \
+     XGetWindowProperty(D, W, P, O, L, DEL, T, AT, AF, N, B, V))
+#define XGetClassHint(D, W, C) \
+    (STATS_COUNT(StatsXGetClassHint), XGetClassHint(D, W, C))
+#endif
+
 void *
 xcalloc(size_t nmemb, size_t size) {
     void *p;
@@ -459,45 +1059,655 @@ void error(const char *function, char *format, ...) {
         exit(EXIT_FAILURE);
     }
 
+    message_length = MIN(message_length, (int) sizeof (message) - 1);
+    header_length = MIN(header_length, (int) sizeof (header) - 1);
     message[message_length] = '\0';
     header[header_length] = '\0';
     (void) write(STDERR_FILENO, header, (size_t) header_length);
     (void) write(STDERR_FILENO, message, (size_t) message_length);
 
+    notify_send(function, header, message);
+    return;
+}
+
+/* Drops repeats of any message a function sent this window, anything beyond
+ * NOTIFY_BURST, then queues the rest for the helper without ever
+ * blocking. The count of dropped ones goes with the next message. */
+void
+notify_send(const char *function, char *header, char *message) {
+    NotifySource *source = NULL;
+    uint64 hash = bar_hash(BAR_HASH_SEED, message, strlen(message));
+    time_t now = time(NULL);
+    char packet[512];
+    int length;
+
+    for (int i = 0; i < NOTIFY_SOURCES; i += 1) {
+        NotifySource *candidate = &notify_sources[i];
+        if (candidate->function == function) {
+            source = candidate;
+            break;
+        }
+        if (!source || candidate->window_start < source->window_start)
+            source = candidate;
+    }
+    if (source->function != function)
+        *source = (NotifySource){ .function = function };
+
+    if (now - source->window_start >= NOTIFY_WINDOW_SECONDS) {
+        source->window_start = now;
+        source->sent = 0;
+    }
+    for (int i = 0; i < source->sent; i += 1) {
+        if (source->hashes[i] == hash) {
+            source->suppressed += 1;
+            return;
+        }
+    }
+    if (source->sent >= NOTIFY_BURST) {
+        source->suppressed += 1;
+        return;
+    }
+
+    if (source->suppressed) {
+        length = snprintf(packet, sizeof (packet),
+                          "%s%c%s (%d similar suppressed)",
+                          header, '\0', message, source->suppressed);
+    } else {
+        length = snprintf(packet, sizeof (packet), "%s%c%s",
+                          header, '\0', message);
+    }
+    length = MIN(length, (int) sizeof (packet) - 1);
+
+    if (notify_fd < 0 && !notify_helper_start())
+        return;
+    if (send(notify_fd, packet, (size_t) length + 1,
+             MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            /* helper is gone, start another one next time */
+            close(notify_fd);
+            notify_fd = -1;
+        }
+        source->suppressed += 1;
+        return;
+    }
+    source->hashes[source->sent] = hash;
+    source->sent += 1;
+    source->suppressed = 0;
+    return;
+}
+
+bool
+notify_helper_start(void) {
+    struct sigaction signal_action;
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0) {
+        fprintf(stderr, "Error creating socket pair: %s\n", strerror(errno));
+        return false;
+    }
+
     switch (fork()) {
+    case -1:
+        fprintf(stderr, "Error forking: %s\n", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    case 0:
+        close(fds[0]);
+        if (display)
+            close(ConnectionNumber(display));
+        for (int i = 0; i < FdLast; i += 1) {
+            if (poll_fds[i].fd > STDERR_FILENO)
+                close(poll_fds[i].fd);
+        }
+        setsid();
+
+        /* needs to wait for dunstify, so children are no longer ignored */
+        sigemptyset(&signal_action.sa_mask);
+        signal_action.sa_flags = 0;
+        signal_action.sa_handler = SIG_DFL;
+        sigaction(SIGCHLD, &signal_action, NULL);
+
+        notify_helper_run(fds[1]);
+        exit(EXIT_SUCCESS);
+    default:
+        close(fds[1]);
+        break;
+    }
+    notify_fd = fds[0];
+    return true;
+}
+
+/* Connects to one "unix:" entry of a bus address, path or abstract,
+ * with %xx escapes decoded. Returns the socket, or -1. */
+int
+notify_bus_open(const char *entry, size_t entry_length) {
+    struct sockaddr_un name = { .sun_family = AF_UNIX };
+    const char *end = entry + entry_length;
+    const char *key = entry + strlen("unix:");
+    size_t length = 0;
+    bool found = false;
+    int fd;
+
+    if (entry_length < strlen("unix:") || strncmp(entry, "unix:", 5))
+        return -1;
+    while (key < end && !found) {
+        const char *pair_end = memchr(key, ',', (size_t)(end - key));
+        const char *value;
+
+        if (!pair_end)
+            pair_end = end;
+        if (!strncmp(key, "path=", 5)) {
+            value = key + 5;
+        } else if (!strncmp(key, "abstract=", 9)) {
+            value = key + 9;
+            length = 1;     /* leading NUL of the abstract namespace */
+        } else {
+            key = pair_end + 1;
+            continue;
+        }
+        for (; value < pair_end; value += 1) {
+            uint byte = (uchar)*value;
+
+            if (*value == '%' && pair_end - value >= 3
+                && sscanf(value + 1, "%2x", &byte) == 1)
+                value += 2;
+            if (length >= sizeof (name.sun_path) - 1)
+                return -1;
+            name.sun_path[length++] = (char)byte;
+        }
+        found = true;
+    }
+    if (!found)
+        return -1;
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&name,
+                (socklen_t)(sizeof (name) - sizeof (name.sun_path)
+                            + length)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Connects to the first reachable unix entry of the session bus
+ * address, authenticates as our uid and waits for the reply to Hello.
+ * Returns the socket, or -1. */
+int
+notify_bus_connect(void) {
+    const char *address = getenv("DBUS_SESSION_BUS_ADDRESS");
+    NotifyBuffer empty = {0};
+    char uid[16];
+    char auth[64];
+    char reply[256];
+    size_t length;
+    size_t received = 0;
+    int fd = -1;
+
+    for (const char *entry = address; entry && *entry && fd < 0;) {
+        size_t entry_length = strcspn(entry, ";");
+
+        fd = notify_bus_open(entry, entry_length);
+        entry += entry_length + (entry[entry_length] == ';');
+    }
+    if (fd < 0)
+        return -1;
+    notify_bus_input.length = 0;
+
+    /* EXTERNAL takes the uid as decimal text, hex encoded */
+    snprintf(uid, sizeof (uid), "%u", (uint)getuid());
+    length = (size_t)snprintf(auth, sizeof (auth), "AUTH EXTERNAL ");
+    for (char *digit = uid; *digit; digit += 1)
+        length += (size_t)snprintf(auth + length, sizeof (auth) - length,
+                                   "%02x", (uint)*digit);
+    length += (size_t)snprintf(auth + length, sizeof (auth) - length, "\r\n");
+    if (send(fd, "", 1, MSG_NOSIGNAL) != 1
+        || send(fd, auth, length, MSG_NOSIGNAL) != (ssize_t)length) {
+        close(fd);
+        return -1;
+    }
+    while (received < sizeof (reply) - 1
+           && !memchr(reply, '\n', received)) {
+        ssize_t n = recv(fd, reply + received,
+                         sizeof (reply) - 1 - received, 0);
+        if (n <= 0) {
+            close(fd);
+            return -1;
+        }
+        received += (size_t)n;
+    }
+    if (received < 3 || strncmp(reply, "OK ", 3)
+        || send(fd, "BEGIN\r\n", 7, MSG_NOSIGNAL) != 7
+        || !notify_bus_call(fd, 1, "org.freedesktop.DBus",
+                            "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                            "Hello", NULL, &empty)
+        || notify_bus_read(fd, 1, NOTIFY_REPLY_MILIS) != NotifyBusReturn) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+uint32
+notify_bus_get32(const uchar *data, bool swap) {
+    uint32 value;
+
+    memcpy(&value, data, sizeof (value));
+    if (swap)
+        value = __builtin_bswap32(value);
+    return value;
+}
+
+/* Takes the first complete message out of notify_bus_input. Returns its
+ * length, 0 while it is incomplete, or -1 when it cannot be parsed. Its
+ * type and REPLY_SERIAL, 0 if it has none, go to type and reply_serial. */
+int
+notify_bus_parse(uint *type, uint32 *reply_serial) {
+    const uchar *data = notify_bus_input.data;
+    const int probe = 1;
+    bool swap;
+    uint32 fields_end;
+    uint32 total;
+    uint32 at = 16;
+
+    *reply_serial = 0;
+    if (notify_bus_input.length < 16)
+        return 0;
+    if (data[0] != 'l' && data[0] != 'B')
+        return -1;
+    swap = (data[0] == 'l') != (*(const char *)&probe == 1);
+    *type = data[1];
+    fields_end = 16 + notify_bus_get32(data + 12, swap);
+    if (fields_end > sizeof (notify_bus_input.data))
+        return -1;
+    total = ((fields_end + 7) & ~7u) + notify_bus_get32(data + 4, swap);
+    if (total > sizeof (notify_bus_input.data))
+        return -1;
+    if (notify_bus_input.length < total)
+        return 0;
+
+    while (at < fields_end) {
+        uchar code;
+        uchar value_type;
+
+        at = (at + 7) & ~7u;
+        if (at + 4 > fields_end || data[at + 1] != 1)
+            return -1;
+        code = data[at];
+        value_type = data[at + 2];
+        at += 4;
+        switch (value_type) {
+        case 'u':
+        case 's':
+        case 'o': {
+            uint32 value;
+
+            at = (at + 3) & ~3u;
+            if (at + 4 > fields_end)
+                return -1;
+            value = notify_bus_get32(data + at, swap);
+            at += 4;
+            if (value_type == 'u') {
+                if (code == 5)
+                    *reply_serial = value;
+            } else {
+                at += value + 1;
+            }
+            break;
+        }
+        case 'g':
+            at += 1u + data[at] + 1u;
+            break;
+        default:
+            return -1;
+        }
+        if (at > fields_end)
+            return -1;
+    }
+    return (int)total;
+}
+
+/* Reads what the bus sends until the reply to serial comes, for at most
+ * timeout milliseconds. Other messages, signals mostly, are dropped, and
+ * with serial 0 only what already arrived is drained. */
+int
+notify_bus_read(int fd, uint32 serial, int timeout) {
+    struct timespec start;
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (;;) {
+        int length;
+        int left;
+        uint type;
+        uint32 reply_serial;
+        ssize_t n;
+
+        while ((length = notify_bus_parse(&type, &reply_serial)) > 0) {
+            notify_bus_input.length -= (uint32)length;
+            memmove(notify_bus_input.data,
+                    notify_bus_input.data + length,
+                    notify_bus_input.length);
+            if (serial && reply_serial == serial && type == 2)
+                return NotifyBusReturn;
+            if (serial && reply_serial == serial && type == 3)
+                return NotifyBusError;
+        }
+        if (length < 0)
+            return NotifyBusBroken;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        left = timeout - (int)((now.tv_sec - start.tv_sec)*1000
+                               + (now.tv_nsec - start.tv_nsec) / 1000000);
+        switch (poll(&(struct pollfd){ .fd = fd, .events = POLLIN }, 1,
+                     MAX(left, 0))) {
+        case -1:
+            if (errno == EINTR)
+                continue;
+            return NotifyBusBroken;
+        case 0:
+            return NotifyBusNothing;
+        default:
+            break;
+        }
+        n = recv(fd, notify_bus_input.data + notify_bus_input.length,
+                 sizeof (notify_bus_input.data) - notify_bus_input.length,
+                 MSG_DONTWAIT);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+            return NotifyBusBroken;
+        if (n > 0)
+            notify_bus_input.length += (uint32)n;
+    }
+}
+
+/* The bus drops a connection sending invalid UTF-8: anything that is
+ * not a well formed, shortest, non surrogate sequence becomes '?'. */
+void
+notify_utf8_clean(char *text) {
+    uchar *byte = (uchar *)text;
+
+    while (*byte) {
+        uint32 codepoint = *byte;
+        uint32 minimum;
+        int length;
+        int i;
+
+        if (codepoint < 0x80) {
+            byte += 1;
+            continue;
+        } else if ((codepoint & 0xE0) == 0xC0) {
+            length = 1;
+            codepoint &= 0x1F;
+            minimum = 0x80;
+        } else if ((codepoint & 0xF0) == 0xE0) {
+            length = 2;
+            codepoint &= 0x0F;
+            minimum = 0x800;
+        } else if ((codepoint & 0xF8) == 0xF0) {
+            length = 3;
+            codepoint &= 0x07;
+            minimum = 0x10000;
+        } else {
+            *byte++ = '?';
+            continue;
+        }
+        for (i = 1; i <= length && (byte[i] & 0xC0) == 0x80; i += 1)
+            codepoint = codepoint << 6 | (byte[i] & 0x3F);
+        if (i <= length || codepoint < minimum || codepoint > 0x10FFFF
+            || (codepoint >= 0xD800 && codepoint <= 0xDFFF)) {
+            *byte++ = '?';
+            continue;
+        }
+        byte += length + 1;
+    }
+    return;
+}
+
+void
+notify_bus_put(NotifyBuffer *buffer, const void *data, uint32 size) {
+    if (buffer->overflow || size > sizeof (buffer->data) - buffer->length) {
+        buffer->overflow = true;
+        return;
+    }
+    memcpy(buffer->data + buffer->length, data, size);
+    buffer->length += size;
+    return;
+}
+
+void
+notify_bus_align(NotifyBuffer *buffer, uint32 alignment) {
+    static const uchar zeros[8];
+
+    notify_bus_put(buffer, zeros,
+                   (alignment - buffer->length % alignment) % alignment);
+    return;
+}
+
+void
+notify_bus_uint32(NotifyBuffer *buffer, uint32 value) {
+    notify_bus_align(buffer, 4);
+    notify_bus_put(buffer, &value, sizeof (value));
+    return;
+}
+
+/* also an object path, which is marshalled the same */
+void
+notify_bus_string(NotifyBuffer *buffer, const char *string) {
+    uint32 length = (uint32)strlen(string);
+
+    notify_bus_uint32(buffer, length);
+    notify_bus_put(buffer, string, length + 1);
+    return;
+}
+
+void
+notify_bus_signature(NotifyBuffer *buffer, const char *signature) {
+    uchar length = (uchar)strlen(signature);
+
+    notify_bus_put(buffer, &length, 1);
+    notify_bus_put(buffer, signature, (uint32)length + 1);
+    return;
+}
+
+/* one (code, variant) entry of the header field array */
+void
+notify_bus_field(NotifyBuffer *buffer, uchar code, char type,
+                 const char *value) {
+    char signature[2] = { type, '\0' };
+
+    notify_bus_align(buffer, 8);
+    notify_bus_put(buffer, &code, 1);
+    notify_bus_signature(buffer, signature);
+    if (type == 'g')
+        notify_bus_signature(buffer, value);
+    else
+        notify_bus_string(buffer, value);
+    return;
+}
+
+/* Sends a method call, body marshalled after a header in host byte
+ * order. The reply is for notify_bus_read(). */
+bool
+notify_bus_call(int fd, uint32 serial, const char *destination,
+                const char *path, const char *interface, const char *member,
+                const char *signature, NotifyBuffer *body) {
+    static NotifyBuffer message;
+    const int probe = 1;
+    /* endianness, METHOD_CALL, no flags, protocol version */
+    uchar fixed[4] = { *(const char *)&probe ? 'l' : 'B', 1, 0, 1 };
+    uint32 fields_at;
+    uint32 fields_length;
+    uint32 sent = 0;
+
+    message.length = 0;
+    message.overflow = false;
+    notify_bus_put(&message, fixed, sizeof (fixed));
+    notify_bus_uint32(&message, body->length);
+    notify_bus_uint32(&message, serial);
+    notify_bus_uint32(&message, 0);
+    fields_at = message.length;
+    notify_bus_field(&message, 1, 'o', path);
+    notify_bus_field(&message, 2, 's', interface);
+    notify_bus_field(&message, 3, 's', member);
+    notify_bus_field(&message, 6, 's', destination);
+    if (signature)
+        notify_bus_field(&message, 8, 'g', signature);
+    fields_length = message.length - fields_at;
+    memcpy(message.data + fields_at - 4, &fields_length, 4);
+    notify_bus_align(&message, 8);
+    notify_bus_put(&message, body->data, body->length);
+    if (message.overflow || body->overflow)
+        return false;
+
+    while (sent < message.length) {
+        ssize_t n = send(fd, message.data + sent, message.length - sent,
+                         MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        sent += (uint32)n;
+    }
+    return true;
+}
+
+/* org.freedesktop.Notifications.Notify, what dunstify -u critical sends */
+bool
+notify_bus_notify(int fd, uint32 serial, const char *summary,
+                  const char *text) {
+    static NotifyBuffer body;
+    const uchar critical = 2;
+    uint32 length_at;
+    uint32 hints_at;
+    uint32 hints_length;
+
+    body.length = 0;
+    body.overflow = false;
+    notify_bus_string(&body, "dwm");       /* app_name */
+    notify_bus_uint32(&body, 0);           /* replaces_id */
+    notify_bus_string(&body, "");          /* app_icon */
+    notify_bus_string(&body, summary);
+    notify_bus_string(&body, text);
+    notify_bus_uint32(&body, 0);           /* no actions */
+    notify_bus_uint32(&body, 0);           /* hints, length patched below */
+    length_at = body.length - 4;
+    notify_bus_align(&body, 8);
+    hints_at = body.length;
+    notify_bus_string(&body, "urgency");
+    notify_bus_signature(&body, "y");
+    notify_bus_put(&body, &critical, 1);
+    hints_length = body.length - hints_at;
+    if (!body.overflow)
+        memcpy(body.data + length_at, &hints_length, 4);
+    notify_bus_uint32(&body, NOTIFY_TIMEOUT_MILIS);
+
+    return notify_bus_call(fd, serial, "org.freedesktop.Notifications",
+                           "/org/freedesktop/Notifications",
+                           "org.freedesktop.Notifications", "Notify",
+                           "susssasa{sv}i", &body);
+}
+
+/* without a session bus: dunstify, waited for */
+void
+notify_helper_exec(const char *summary, const char *text) {
+    pid_t child;
+
+    switch (child = fork()) {
     case -1:
         fprintf(stderr, "Error forking: %s\n", strerror(errno));
         break;
     case 0:
         execlp("dunstify", "dunstify", "-u", "critical", "-t", "2000",
-                           header, message, NULL);
+                           summary, text, NULL);
         fprintf(stderr, "Error trying to exec dunstify.\n");
         exit(EXIT_FAILURE);
     default:
+        while (waitpid(child, NULL, 0) < 0 && errno == EINTR);
         break;
     }
     return;
 }
 
+/* Helper process: sends notifications over one bus connection, made
+ * again when it breaks, until dwm closes its end, which happens on exit
+ * and across restarts thanks to CLOEXEC. A message counts as shown only
+ * once the notification daemon answered; otherwise dunstify gets it. */
+void
+notify_helper_run(int fd) {
+    char packet[512];
+    int bus = notify_bus_connect();
+    uint32 serial = 2;
+
+    for (;;) {
+        struct pollfd fds[2] = {
+            { .fd = fd, .events = POLLIN },
+            { .fd = bus, .events = POLLIN },
+        };
+        ssize_t length;
+        char *message;
+        int answer = NotifyBusBroken;
+
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (fds[1].revents
+            && notify_bus_read(bus, 0, 0) == NotifyBusBroken) {
+            close(bus);
+            bus = -1;
+        }
+        if (!fds[0].revents)
+            continue;
+
+        if ((length = recv(fd, packet, sizeof (packet) - 1, 0)) == 0)
+            break;
+        if (length < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        packet[length] = '\0';
+        message = packet + strlen(packet);
+        message += message < packet + length;
+        notify_utf8_clean(packet);
+        notify_utf8_clean(message);
+
+        if (bus < 0)
+            bus = notify_bus_connect();
+        if (bus >= 0 && notify_bus_notify(bus, serial, packet, message))
+            answer = notify_bus_read(bus, serial, NOTIFY_REPLY_MILIS);
+        serial += 1;
+        if (answer == NotifyBusReturn)
+            continue;
+        if (bus >= 0 && answer != NotifyBusError) {
+            close(bus);
+            bus = -1;
+        }
+        notify_helper_exec(packet, message);
+    }
+    if (bus >= 0)
+        close(bus);
+    return;
+}
+
+/* Switching only changes what the bar previews: nothing is viewed,
+ * arranged or focused until the modifier or the button is released. */
 void
 user_alt_tab(const Arg *) {
-    static bool alt_tab_direction = false;
-    Monitor *old_monitor = live_monitor;
-    Client *client;
     bool grabbed = false;
     int grab_status = 1000;
 
     if (all_clients == NULL)
         return;
 
-    for (Monitor *monitor = monitors; monitor; monitor = monitor->next) {
-        monitor_focus(monitor, false);
-        view_tag((uint)~0);
-        set_layout(&layouts[3]);
-    }
-    monitor_focus(old_monitor, false);
-    client_focus(live_monitor->selected_client);
-    focus_next(alt_tab_direction);
+    alt_tab_gather(None);
+    alt_tab.selected = alt_tab.number_clients > 1 ? 1 : 0;
+    alt_tab.active = true;
+    monitor_set_dirty(live_monitor, DirtyBars);
+    flush_dirty_monitors();
 
     for (int i = 0; i < ALT_TAB_GRAB_TRIES; i += 1) {
         struct timespec pause;
@@ -517,91 +1727,164 @@ user_alt_tab(const Arg *) {
         }
         nanosleep(&pause, NULL);
     }
+    if (!grabbed) {
+        alt_tab.active = false;
+        XUngrabKeyboard(display, CurrentTime);
+        monitor_set_dirty(live_monitor, DirtyBars);
+        return;
+    }
 
-    client = live_monitor->selected_client;
-    while (grabbed) {
+    while (alt_tab.active) {
         XEvent event;
-        Monitor *monitor;
 
         XNextEvent(display, &event);
         switch (event.type) {
         case ConfigureRequest:
         case DestroyNotify:
         case Expose:
-        case MapRequest:
-            handlers[event.type](&event);
+        case MapRequest: {
+            Client *selected = alt_tab.clients[alt_tab.selected];
+            Window window = selected ? selected->window : None;
+
+            event_dispatch(&event);
+            /* managing or unmanaging may change the candidates */
+            alt_tab_gather(window);
             break;
+        }
         case KeyPress:
             if (event.xkey.keycode == tabCycleKey)
-                focus_next(alt_tab_direction);
-            else if (event.xkey.keycode == key_j)
-                focus_direction(0);
-            else if (event.xkey.keycode == key_semicolon)
-                focus_direction(1);
-            else if (event.xkey.keycode == key_l)
-                focus_direction(2);
+                alt_tab_step(event.xkey.state & ShiftMask ? -1 : +1);
             else if (event.xkey.keycode == key_k)
-                focus_direction(3);
-            client = live_monitor->selected_client;
+                alt_tab_step(+1);
+            else if (event.xkey.keycode == key_l)
+                alt_tab_step(-1);
             break;
         case KeyRelease:
-            if (event.xkey.keycode == tabModKey) {
-                XUngrabKeyboard(display, CurrentTime);
-                XUngrabButton(display, AnyButton, AnyModifier, None);
-                grabbed = false;
-                alt_tab_direction = !alt_tab_direction;
-                view_tag(client->tags);
-            }
+            if (event.xkey.keycode == tabModKey)
+                alt_tab_finish();
             break;
         case ButtonPress: {
-            XButtonPressedEvent *button_event = &(event.xbutton);
-            monitor = window_to_monitor(button_event->window);
-            if (monitor && (monitor != live_monitor))
-                monitor_focus(monitor, true);
+            Client *client = window_to_client(event.xbutton.window);
 
-            if ((client = window_to_client(button_event->window)))
-                client_focus(client);
+            for (int i = 0; client && i < alt_tab.number_clients; i += 1) {
+                if (alt_tab.clients[i] == client)
+                    alt_tab.selected = i;
+            }
             XAllowEvents(display, AsyncBoth, CurrentTime);
             break;
         }
         case ButtonRelease:
-            XUngrabKeyboard(display, CurrentTime);
-            XUngrabButton(display, AnyButton, AnyModifier, None);
-            grabbed = false;
-            alt_tab_direction = !alt_tab_direction;
-            view_tag(client->tags);
+            alt_tab_finish();
             break;
         default:
             break;
         }
+        flush_dirty_monitors();
     }
     return;
 }
 
 void
-user_aspect_resize(const Arg *arg) {
-    Monitor *monitor = live_monitor;
-    Client *client = live_monitor->selected_client;
-    float ratio;
-    int w, h;
-    bool monitor_floating = !monitor->layout[monitor->lay_i]->function;
+alt_tab_finish(void) {
+    Client *client = alt_tab.clients[alt_tab.selected];
 
-    if (!arg)
-        return;
-    if (client == NULL)
-        return;
+    XUngrabKeyboard(display, CurrentTime);
+    XUngrabButton(display, AnyButton, AnyModifier, None);
+    alt_tab.active = false;
+    monitor_set_dirty(live_monitor, DirtyBars);
 
-    if (!client->is_floating && !monitor_floating)
+    if (client == NULL)
         return;
-
-    ratio = (float)client->w / (float)client->h;
-    h = arg->i;
-    w = (int)(ratio*(float)h);
-
-    XRaiseWindow(display, client->window);
-    client_resize(client,
-                  client->x, client->y, client->w + w, client->h + h,
-                  true);
+    if (client->monitor != live_monitor)
+        monitor_focus(client->monitor, false);
+    if (!client_is_visible(client))
+        view_tag(client->tags);
+    client_focus(client);
+    monitor_restack(live_monitor);
+    return;
+}
+
+/* keeps the selection on window if it is still managed */
+void
+alt_tab_gather(Window window) {
+    int n = 0;
+
+    for (Client *client = all_clients;
+         client;
+         client = client_cold(client)->all_next)
+        n += 1;
+    if (n + 1 > alt_tab.capacity) {
+        alt_tab.capacity = MAX(2*alt_tab.capacity, n + 1);
+        free(alt_tab.clients);
+        alt_tab.clients = xcalloc((size_t)alt_tab.capacity,
+                                  sizeof(*alt_tab.clients));
+    }
+
+    alt_tab.number_clients = 0;
+    for (Client *client = live_monitor->stack;
+                 client;
+                 client = client->stack_next) {
+        alt_tab.clients[alt_tab.number_clients] = client;
+        alt_tab.number_clients += 1;
+    }
+    for (Monitor *monitor = monitors; monitor; monitor = monitor->next) {
+        if (monitor == live_monitor)
+            continue;
+        for (Client *client = monitor->stack;
+                     client;
+                     client = client->stack_next) {
+            alt_tab.clients[alt_tab.number_clients] = client;
+            alt_tab.number_clients += 1;
+        }
+    }
+    alt_tab.clients[alt_tab.number_clients] = NULL;
+
+    if (window == None)
+        return;
+    alt_tab.selected = 0;
+    for (int i = 0; i < alt_tab.number_clients; i += 1) {
+        if (alt_tab.clients[i]->window == window)
+            alt_tab.selected = i;
+    }
+    monitor_set_dirty(live_monitor, DirtyBars);
+    return;
+}
+
+void
+alt_tab_step(int step) {
+    int n = alt_tab.number_clients;
+
+    if (n == 0)
+        return;
+    alt_tab.selected = ((alt_tab.selected + step) % n + n) % n;
+    monitor_set_dirty(live_monitor, DirtyBars);
+    return;
+}
+
+void
+user_aspect_resize(const Arg *arg) {
+    Monitor *monitor = live_monitor;
+    Client *client = live_monitor->selected_client;
+    float ratio;
+    int w, h;
+    bool monitor_floating = !monitor->layout[monitor->lay_i]->function;
+
+    if (!arg)
+        return;
+    if (client == NULL)
+        return;
+
+    if (!client->is_floating && !monitor_floating)
+        return;
+
+    ratio = (float)client->w / (float)client->h;
+    h = arg->i;
+    w = (int)(ratio*(float)h);
+
+    XRaiseWindow(display, client->window);
+    client_resize(client,
+                  client->x, client->y, client->w + w, client->h + h,
+                  true);
     return;
 }
 
@@ -732,6 +2015,8 @@ user_mouse_move(const Arg *) {
     Client *client;
     Monitor *monitor_aux;
     XEvent event;
+    XMotionEvent motion = {0};
+    bool pending = false;
     Time last_time = 0;
     int success;
     int x, y;
@@ -763,52 +2048,30 @@ user_mouse_move(const Arg *) {
         case ConfigureRequest:
         case Expose:
         case MapRequest:
-            handlers[event.type](&event);
+            event_dispatch(&event);
             break;
-        case MotionNotify: {
-            Monitor *monitor = live_monitor;
-            bool is_floating = client->is_floating;
-            int new_x = ocx + (event.xmotion.x - x);
-            int new_y = ocy + (event.xmotion.y - y);
-            int client_width = client_pixels_width(client);
-            int client_height = client_pixels_height(client);
-            int over_x[2] = {
-                abs(monitor->win_x - new_x),
-                abs(monitor->win_x + monitor->win_w - (new_x + client_width)),
-            };
-            int over_y[2] = {
-                abs(monitor->win_y - new_y),
-                abs(monitor->win_y + monitor->win_h - (new_y + client_height)),
-            };
-
-            if ((event.xmotion.time - last_time) <= (1000 / 60))
-                continue;
-            last_time = event.xmotion.time;
-
-            if (over_x[0] < SNAP_PIXELS)
-                new_x = monitor->win_x;
-            else if (over_x[1] < SNAP_PIXELS)
-                new_x = monitor->win_x + monitor->win_w - client_width;
-
-            if (over_y[0] < SNAP_PIXELS)
-                new_y = monitor->win_y;
-            else if (over_y[1] < SNAP_PIXELS)
-                new_y = monitor->win_y + monitor->win_h - client_height;
-
-            if (!is_floating && monitor->layout[monitor->lay_i]->function) {
-                bool moving_x = abs(new_x - client->x) > SNAP_PIXELS;
-                bool moving_y = abs(new_y - client->y) > SNAP_PIXELS;
-                if (moving_x || moving_y)
-                    user_toggle_floating(NULL);
+        case MotionNotify:
+            event_drain_motion(&event);
+            motion = event.xmotion;
+            pending = true;
+            if ((motion.time - last_time) <= live_monitor->frame_milis)
+                break;
+            last_time = motion.time;
+            pending = false;
+            client_drag_move(client,
+                             ocx + (motion.x - x), ocy + (motion.y - y));
+            break;
+        case ButtonRelease:
+            /* the last position may have come too early to be applied */
+            if (pending) {
+                client_drag_move(client,
+                                 ocx + (motion.x - x), ocy + (motion.y - y));
             }
-
-            if (!monitor->layout[monitor->lay_i]->function || is_floating)
-                client_resize(client, new_x, new_y, client->w, client->h, true);
             break;
-        }
         default:
             break;
         }
+        flush_dirty_monitors();
     } while (event.type != ButtonRelease);
 
     XUngrabPointer(display, CurrentTime);
@@ -828,6 +2091,8 @@ user_mouse_resize(const Arg *) {
     Client *client;
     Monitor *monitor;
     XEvent event;
+    XMotionEvent motion = {0};
+    bool pending = false;
     Time last_time = 0;
     int success;
 
@@ -856,48 +2121,26 @@ user_mouse_resize(const Arg *) {
         case ConfigureRequest:
         case Expose:
         case MapRequest:
-            handlers[event.type](&event);
+            event_dispatch(&event);
             break;
-        case MotionNotify: {
-            bool monitor_floating;
-            int new_w, new_h, new_x, new_y;
-            bool over_x, under_x, over_y, under_y;
-
-            if ((event.xmotion.time - last_time) <= (1000 / 60))
-                continue;
-            last_time = event.xmotion.time;
-
-            event.xmotion.x += (-client->x - 2*client->border_pixels + 1);
-            event.xmotion.y += (-client->y - 2*client->border_pixels + 1);
-
-            new_w = MAX(event.xmotion.x, 1);
-            new_h = MAX(event.xmotion.y, 1);
-
-            monitor_floating
-                = !(live_monitor->layout[live_monitor->lay_i]->function);
-            if (!client->is_floating && !monitor_floating) {
-                bool over_snap_x = abs(new_w - client->w) > SNAP_PIXELS;
-                bool over_snap_y = abs(new_h - client->h) > SNAP_PIXELS;
-
-                new_x = client->monitor->win_x + new_w;
-                new_y = client->monitor->win_y + new_h;
-                over_x = new_x >= live_monitor->win_x;
-                under_x = new_x <= live_monitor->win_x + live_monitor->win_w;
-                over_y = new_y >= live_monitor->win_y;
-                under_y = new_y <= live_monitor->win_y + live_monitor->win_h;
-
-                if (over_x && under_x && over_y && under_y
-                    && (over_snap_x || over_snap_y)) {
-                    user_toggle_floating(NULL);
-                }
-            }
-            if (client->is_floating || monitor_floating)
-                client_resize(client, client->x, client->y, new_w, new_h, true);
+        case MotionNotify:
+            event_drain_motion(&event);
+            motion = event.xmotion;
+            pending = true;
+            if ((motion.time - last_time) <= live_monitor->frame_milis)
+                break;
+            last_time = motion.time;
+            pending = false;
+            client_drag_resize(client, motion.x, motion.y);
+            break;
+        case ButtonRelease:
+            if (pending)
+                client_drag_resize(client, motion.x, motion.y);
             break;
-        }
         default:
             break;
         }
+        flush_dirty_monitors();
     } while (event.type != ButtonRelease);
 
     XWarpPointer(display, None, client->window,
@@ -956,49 +2199,21 @@ user_set_master_fact(const Arg *arg) {
 
 void
 user_signal_status_bar(const Arg *arg) {
-    pid_t status_program_pid;
+    pid_t pid;
     union sigval signal_value;
-    int pipefd[2];
-    char buffer[32] = {0};
 
     if (!status_signal)
         return;
     signal_value.sival_int = arg->i | ((SIGRTMIN + status_signal) << 3);
 
-    if (pipe(pipefd) < 0) {
-        error(__func__, "Error creating pipe: %s\n", strerror(errno));
-        status_program_pid = -1;
-        return;
-    }
-
-    switch (fork()) {
-    case -1:
-        error(__func__, "Error forking: %s\n", strerror(errno));
-        close(pipefd[0]);
-        close(pipefd[1]);
-        status_program_pid = -1;
-        return;
-    case 0:
-        close(pipefd[0]);
-        dup2(pipefd[1], STDOUT_FILENO);
-        close(pipefd[1]);
-        execlp("pidof", "pidof", "-s", STATUS_PROGRAM, NULL);
-        error(__func__, "Error executing pidof.\n");
-        exit(EXIT_FAILURE);
-    default:
-        close(pipefd[1]);
-        break;
-    }
-
-    if (read(pipefd[0], buffer, sizeof (buffer) - 1) <= 0) {
-        close(pipefd[0]);
-        status_program_pid = -1;
+    if ((pid = status_program_pid()) <= 0)
         return;
+    if (sigqueue(pid, SIGUSR1, signal_value) < 0 && errno == ESRCH) {
+        /* exited without the pidfd telling us yet */
+        status_forget_pid();
+        if ((pid = status_program_pid()) > 0)
+            sigqueue(pid, SIGUSR1, signal_value);
     }
-    close(pipefd[0]);
-
-    status_program_pid = atoi(buffer);
-    sigqueue(status_program_pid, SIGUSR1, signal_value);
     return;
 }
 
@@ -1009,6 +2224,7 @@ user_tag(const Arg *arg) {
 
     if (which_tag && selected_client) {
         selected_client->tags = which_tag;
+        client_tags_changed(selected_client);
         client_set_client_tag_prop(selected_client);
         client_focus(NULL);
         monitor_arrange(live_monitor);
@@ -1045,6 +2261,7 @@ user_toggle_bar(const Arg *arg) {
 void
 user_toggle_floating(const Arg *) {
     Client *client = live_monitor->selected_client;
+    ClientCold *cold;
 
     if (client == NULL)
         return;
@@ -1052,17 +2269,18 @@ user_toggle_floating(const Arg *) {
     if (client->is_fullscreen && !client->is_fake_fullscreen)
         return;
 
+    cold = client_cold(client);
     client->is_floating = !client->is_floating || client->is_fixed;
+    client_tags_changed(client);
     if (client->is_floating) {
         client_resize(client,
-                      client->stored_fx, client->stored_fy,
-                      client->stored_fw, client->stored_fh,
-                      false);
+                      cold->stored_fx, cold->stored_fy,
+                      cold->stored_fw, cold->stored_fh, false);
     } else {
-        client->stored_fx = client->x;
-        client->stored_fy = client->y;
-        client->stored_fw = client->w;
-        client->stored_fh = client->h;
+        cold->stored_fx = client->x;
+        cold->stored_fy = client->y;
+        cold->stored_fw = client->w;
+        cold->stored_fh = client->h;
     }
     client_center(client);
     monitor_arrange(live_monitor);
@@ -1114,6 +2332,7 @@ user_toggle_tag(const Arg *arg) {
     newtags = live_monitor->selected_client->tags ^ (arg->ui & TAGMASK);
     if (newtags) {
         live_monitor->selected_client->tags = newtags;
+        client_tags_changed(live_monitor->selected_client);
         client_set_client_tag_prop(live_monitor->selected_client);
         client_focus(NULL);
         monitor_arrange(live_monitor);
@@ -1190,46 +2409,44 @@ user_promote_to_master(const Arg *) {
     return;
 }
 
+/* Every matching rule applies in order, the later ones winning where
+ * they conflict. Centring and switching tags wait until all are known. */
 void
 client_apply_rules(Client *client) {
+    ClientCold *cold = client_cold(client);
     const char *class;
     const char *instance;
-    XClassHint class_hint = { NULL, NULL };
+    const Rule *switch_rule = NULL;
+    bool center = false;
+    uint64 matched[RULE_WORDS];
 
     client->is_floating = false;
     client->tags = 0;
-    XGetClassHint(display, client->window, &class_hint);
-    class    = class_hint.res_class ? class_hint.res_class : broken;
-    instance = class_hint.res_name  ? class_hint.res_name  : broken;
+    class    = cold->class[0]    ? cold->class    : broken;
+    instance = cold->instance[0] ? cold->instance : broken;
 
-    for (int i = 0; i < LENGTH(rules); i += 1) {
-        const Rule *rule = &rules[i];
-        Monitor *monitor_aux;
+    rules_match(class, instance, cold->name, matched);
+    for (int word = 0; word < (int)RULE_WORDS; word += 1) {
+        for (uint64 bits = matched[word]; bits; bits &= bits - 1) {
+            const Rule *rule = &rules[word*64 + __builtin_ctzll(bits)];
+            Monitor *monitor;
 
-        if ((!rule->title || strstr(client->name, rule->title))
-            && (!rule->class || strstr(class, rule->class))
-            && (!rule->instance || strstr(instance, rule->instance))) {
             client->is_floating = rule->is_floating;
             client->is_fake_fullscreen = rule->is_fake_fullscreen;
             client->tags |= rule->tags;
+            center |= rule->is_floating;
 
-            if (rule->is_floating)
-                client_center(client);
-
-            for (monitor_aux = monitors;
-                 monitor_aux && monitor_aux->num != rule->monitor;
-                 monitor_aux = monitor_aux->next);
-            if (monitor_aux)
-                client->monitor = monitor_aux;
-
+            if ((monitor = num_to_monitor(rule->monitor)))
+                client->monitor = monitor;
             if (rule->switchtotag)
-                view_tag(rule->tags);
+                switch_rule = rule;
         }
     }
-    if (class_hint.res_class)
-        XFree(class_hint.res_class);
-    if (class_hint.res_name)
-        XFree(class_hint.res_name);
+
+    if (center)
+        client_center(client);
+    if (switch_rule)
+        view_tag(switch_rule->tags);
 
     if (client->tags & TAGMASK) {
         client->tags = client->tags & TAGMASK;
@@ -1243,6 +2460,7 @@ client_apply_rules(Client *client) {
 int
 client_apply_size_hints(Client *client,
                         int *x, int *y, int *w, int *h, bool interact) {
+    SizeHints *hints = &client_cold(client)->hints;
     Monitor *monitor = client->monitor;
     int success;
 
@@ -1283,49 +2501,186 @@ client_apply_size_hints(Client *client,
             client_update_size_hints(client);
 
         /* see last two sentences in ICCCM 4.1.2.3 */
-        base_is_min = client->base_w == client->min_w
-                      && client->base_h == client->min_h;
+        base_is_min = hints->base_w == hints->min_w
+                      && hints->base_h == hints->min_h;
         if (!base_is_min) { /* temporarily remove base dimensions */
-            *w -= client->base_w;
-            *h -= client->base_h;
+            *w -= hints->base_w;
+            *h -= hints->base_h;
         }
 
         /* adjust for aspect limits */
-        if (client->min_aspect > 0 && client->max_aspect > 0) {
-            if (client->max_aspect < (float)*w / (float)*h)
-                *w = *h*((int)(client->max_aspect + 0.5f));
-            else if (client->min_aspect < (float)*h / (float)*w)
-                *h = *w*((int)(client->min_aspect + 0.5f));
+        if (hints->min_aspect > 0 && hints->max_aspect > 0) {
+            if (hints->max_aspect < (float)*w / (float)*h)
+                *w = *h*((int)(hints->max_aspect + 0.5f));
+            else if (hints->min_aspect < (float)*h / (float)*w)
+                *h = *w*((int)(hints->min_aspect + 0.5f));
         }
 
         if (base_is_min) { /* increment calculation requires this */
-            *w -= client->base_w;
-            *h -= client->base_h;
+            *w -= hints->base_w;
+            *h -= hints->base_h;
         }
 
         /* adjust for increment value */
-        if (client->increment_w)
-            *w -= *w % client->increment_w;
-        if (client->increment_h)
-            *h -= *h % client->increment_h;
+        if (hints->increment_w)
+            *w -= *w % hints->increment_w;
+        if (hints->increment_h)
+            *h -= *h % hints->increment_h;
 
         /* restore base dimensions */
-        *w = MAX(*w + client->base_w, client->min_w);
-        *h = MAX(*h + client->base_h, client->min_h);
-        if (client->max_w)
-            *w = MIN(*w, client->max_w);
-        if (client->max_h)
-            *h = MIN(*h, client->max_h);
+        *w = MAX(*w + hints->base_w, hints->min_w);
+        *h = MAX(*h + hints->base_h, hints->min_h);
+        if (hints->max_w)
+            *w = MIN(*w, hints->max_w);
+        if (hints->max_h)
+            *h = MIN(*h, hints->max_h);
     }
     success = *x != client->x || *y != client->y
              || *w != client->w || *h != client->h;
     return success;
 }
 
+Client *
+client_alloc(void) {
+    Client *client;
+
+    if (!client_free_list) {
+        ClientSlab *slab;
+        void *memory;
+        int error_number;
+
+        error_number = posix_memalign(&memory,
+                                      CLIENT_SLAB_SIZE, sizeof(*slab));
+        if (error_number) {
+            error(__func__, "posix_memalign: %s\n", strerror(error_number));
+            exit(EXIT_FAILURE);
+        }
+        slab = memory;
+        memset(slab, 0, sizeof(*slab));
+        slab->next = client_slabs;
+        client_slabs = slab;
+        for (size_t i = CLIENT_SLAB_CLIENTS; i-- > 0;) {
+            slab->clients[i].next = client_free_list;
+            client_free_list = &slab->clients[i];
+        }
+    }
+
+    client = client_free_list;
+    client_free_list = client->next;
+    memset(client, 0, sizeof(*client));
+    memset(client_cold(client), 0, sizeof(ClientCold));
+    return client;
+}
+
+ClientCold *
+client_cold(Client *client) {
+    uintptr_t address = (uintptr_t)client;
+    ClientSlab *slab;
+
+    slab = (ClientSlab *)(address & ~(uintptr_t)(CLIENT_SLAB_SIZE - 1));
+    return &slab->colds[client - slab->clients];
+}
+
+void
+client_release(Client *client) {
+    client->next = client_free_list;
+    client_free_list = client;
+    return;
+}
+
+void
+client_list_add(Window window) {
+    if (client_list.number_windows >= client_list.capacity) {
+        int capacity = MAX(2*client_list.capacity, 64);
+        Window *windows = xcalloc((size_t)capacity, sizeof(*windows));
+
+        if (client_list.number_windows)
+            memcpy(windows, client_list.windows,
+                   (size_t)client_list.number_windows*sizeof(*windows));
+        free(client_list.windows);
+        free(client_list.stacking);
+        client_list.windows = windows;
+        client_list.stacking = xcalloc((size_t)capacity, sizeof(Window));
+        client_list.number_stacking = -1;
+        client_list.capacity = capacity;
+    }
+    client_list.windows[client_list.number_windows] = window;
+    client_list.number_windows += 1;
+    client_list.dirty = true;
+    return;
+}
+
+void
+client_list_remove(Window window) {
+    int n = client_list.number_windows;
+
+    for (int i = 0; i < n; i += 1) {
+        if (client_list.windows[i] != window)
+            continue;
+        memmove(&client_list.windows[i], &client_list.windows[i + 1],
+                (size_t)(n - i - 1)*sizeof(Window));
+        client_list.number_windows -= 1;
+        client_list.dirty = true;
+        break;
+    }
+    return;
+}
+
+/* Writes _NET_CLIENT_LIST if it changed and, after a restack, the
+ * stacking order. monitor_apply_stack() orders only part of the windows
+ * and others were never restacked by dwm, so the order is read back from
+ * the server: QueryTree lists the children of the root bottom up. The
+ * stacking is only written when it differs, so pagers see no needless
+ * change. */
+void
+client_list_publish(bool restacked) {
+    Window dummy;
+    Window *children = NULL;
+    uint number_children;
+    bool changed;
+    int n = 0;
+
+    if (client_list.dirty) {
+        XChangeProperty(display, root, net_atoms[NET_CLIENT_LIST],
+                        XA_WINDOW, 32, PropModeReplace,
+                        (uchar *)client_list.windows,
+                        client_list.number_windows);
+    }
+    if (!restacked && !client_list.dirty)
+        return;
+    changed = client_list.dirty;
+    client_list.dirty = false;
+
+    if (!XQueryTree(display, root, &dummy, &dummy,
+                    &children, &number_children))
+        return;
+    for (uint i = 0; i < number_children && n < client_list.capacity;
+         i += 1) {
+        if (!window_to_client(children[i]))
+            continue;
+        changed = changed || client_list.stacking[n] != children[i];
+        client_list.stacking[n] = children[i];
+        n += 1;
+    }
+    if (children)
+        XFree(children);
+
+    if (changed || n != client_list.number_stacking) {
+        client_list.number_stacking = n;
+        XChangeProperty(display, root, net_atoms[NET_CLIENT_LIST_STACKING],
+                        XA_WINDOW, 32, PropModeReplace,
+                        (uchar *)client_list.stacking, n);
+    }
+    return;
+}
+
 void
 client_attach(Client *client) {
+    /* it may come from another monitor: place it again on next arrange */
+    client->place_again = true;
+    client_tags_changed(client);
     client->next = client->monitor->clients;
-    client->all_next = all_clients;
+    client_cold(client)->all_next = all_clients;
     client->monitor->clients = client;
     all_clients = client;
     return;
@@ -1359,10 +2714,85 @@ client_configure(Client *client) {
     return;
 }
 
+/* one step of user_mouse_move(), new_x and new_y before snapping */
+void
+client_drag_move(Client *client, int new_x, int new_y) {
+    Monitor *monitor = live_monitor;
+    bool is_floating = client->is_floating;
+    int client_width = client_pixels_width(client);
+    int client_height = client_pixels_height(client);
+    int over_x[2] = {
+        abs(monitor->win_x - new_x),
+        abs(monitor->win_x + monitor->win_w - (new_x + client_width)),
+    };
+    int over_y[2] = {
+        abs(monitor->win_y - new_y),
+        abs(monitor->win_y + monitor->win_h - (new_y + client_height)),
+    };
+
+    if (over_x[0] < SNAP_PIXELS)
+        new_x = monitor->win_x;
+    else if (over_x[1] < SNAP_PIXELS)
+        new_x = monitor->win_x + monitor->win_w - client_width;
+
+    if (over_y[0] < SNAP_PIXELS)
+        new_y = monitor->win_y;
+    else if (over_y[1] < SNAP_PIXELS)
+        new_y = monitor->win_y + monitor->win_h - client_height;
+
+    if (!is_floating && monitor->layout[monitor->lay_i]->function) {
+        bool moving_x = abs(new_x - client->x) > SNAP_PIXELS;
+        bool moving_y = abs(new_y - client->y) > SNAP_PIXELS;
+        if (moving_x || moving_y)
+            user_toggle_floating(NULL);
+    }
+
+    if (!monitor->layout[monitor->lay_i]->function || is_floating)
+        client_resize(client, new_x, new_y, client->w, client->h, true);
+    return;
+}
+
+/* one step of user_mouse_resize(), pointer_x and pointer_y on the root */
+void
+client_drag_resize(Client *client, int pointer_x, int pointer_y) {
+    bool monitor_floating;
+    int new_w, new_h, new_x, new_y;
+    bool over_x, under_x, over_y, under_y;
+
+    pointer_x += (-client->x - 2*client->border_pixels + 1);
+    pointer_y += (-client->y - 2*client->border_pixels + 1);
+
+    new_w = MAX(pointer_x, 1);
+    new_h = MAX(pointer_y, 1);
+
+    monitor_floating
+        = !(live_monitor->layout[live_monitor->lay_i]->function);
+    if (!client->is_floating && !monitor_floating) {
+        bool over_snap_x = abs(new_w - client->w) > SNAP_PIXELS;
+        bool over_snap_y = abs(new_h - client->h) > SNAP_PIXELS;
+
+        new_x = client->monitor->win_x + new_w;
+        new_y = client->monitor->win_y + new_h;
+        over_x = new_x >= live_monitor->win_x;
+        under_x = new_x <= live_monitor->win_x + live_monitor->win_w;
+        over_y = new_y >= live_monitor->win_y;
+        under_y = new_y <= live_monitor->win_y + live_monitor->win_h;
+
+        if (over_x && under_x && over_y && under_y
+            && (over_snap_x || over_snap_y)) {
+            user_toggle_floating(NULL);
+        }
+    }
+    if (client->is_floating || monitor_floating)
+        client_resize(client, client->x, client->y, new_w, new_h, true);
+    return;
+}
+
 void
 client_detach(Client *client) {
     Client **clients;
 
+    client_tags_changed(client);
     for (clients = &client->monitor->clients;
          *clients && *clients != client;
          clients = &(*clients)->next);
@@ -1370,8 +2800,8 @@ client_detach(Client *client) {
 
     for (clients = &all_clients;
          *clients && *clients != client;
-         clients = &(*clients)->all_next);
-    *clients = client->all_next;
+         clients = &client_cold(*clients)->all_next);
+    *clients = client_cold(client)->all_next;
 
     return;
 }
@@ -1431,23 +2861,10 @@ client_focus(Client *client) {
 
 Atom
 client_get_atom_property(Client *client, Atom property) {
-    int actual_format_return;
-    ulong nitems_return;
-    Atom actual_type_return;
-    Atom atom = None;
-    Atom *prop_return = NULL;
-    int success;
+    xcb_get_property_cookie_t cookie;
 
-    success = XGetWindowProperty(display, client->window, property,
-                                0L, sizeof(atom), False, XA_ATOM,
-                                &actual_type_return, &actual_format_return,
-                                &nitems_return, &nitems_return,
-                                (uchar **)&prop_return);
-    if (success == Success && prop_return) {
-        atom = *prop_return;
-        XFree(prop_return);
-    }
-    return atom;
+    cookie = window_property_request(client->window, property, XA_ATOM, 1);
+    return window_read_atom(window_property_reply(cookie));
 }
 
 void
@@ -1488,25 +2905,69 @@ client_center(Client *client) {
 void
 client_new(Window window, XWindowAttributes *window_attributes) {
     Client *client;
+    ClientCold *cold;
     Client *trans_client = NULL;
     Window trans_window = None;
     XWindowChanges window_changes;
-    int success;
-
-    client = xcalloc(1, sizeof(*client));
+    xcb_get_property_cookie_t cookies[PropertyLast];
+    xcb_get_property_reply_t *reply;
+
+    /* ask for everything first, so that managing a window waits
+     * for a single round trip instead of one per property */
+    cookies[PropertyIcon] = window_property_request(window,
+                                net_atoms[NET_WM_ICON],
+                                AnyPropertyType, ICON_PREFIX_LENGTH);
+    cookies[PropertyNetName] = window_property_request(window,
+                                   net_atoms[NET_WM_NAME],
+                                   AnyPropertyType, NAME_SIZE);
+    cookies[PropertyName] = window_property_request(window,
+                                XA_WM_NAME,
+                                AnyPropertyType, NAME_SIZE);
+    cookies[PropertyClass] = window_property_request(window,
+                                 XA_WM_CLASS,
+                                 XA_STRING, CLASS_SIZE);
+    cookies[PropertyTransient] = window_property_request(window,
+                                     XA_WM_TRANSIENT_FOR,
+                                     XA_WINDOW, 1);
+    cookies[PropertyState] = window_property_request(window,
+                                 net_atoms[NET_WM_STATE],
+                                 XA_ATOM, 1);
+    cookies[PropertyWindowType] = window_property_request(window,
+                                      net_atoms[NET_WM_WINDOW_TYPE],
+                                      XA_ATOM, 1);
+    cookies[PropertyNormalHints] = window_property_request(window,
+                                       XA_WM_NORMAL_HINTS,
+                                       XA_WM_SIZE_HINTS,
+                                       SIZE_HINTS_LENGTH);
+    cookies[PropertyHints] = window_property_request(window,
+                                 XA_WM_HINTS,
+                                 XA_WM_HINTS, WM_HINTS_LENGTH);
+    cookies[PropertyClientInfo] = window_property_request(window,
+                                      net_atoms[NET_CLIENT_INFO],
+                                      XA_CARDINAL, 2);
+
+    client = client_alloc();
+    cold = client_cold(client);
     client->window = window;
 
-    client->x = client->old_x = window_attributes->x;
-    client->y = client->old_y = window_attributes->y;
-    client->w = client->old_w = window_attributes->width;
-    client->h = client->old_h = window_attributes->height;
-    client->old_border_pixels = window_attributes->border_width;
+    client->x = cold->old_x = window_attributes->x;
+    client->y = cold->old_y = window_attributes->y;
+    client->w = cold->old_w = window_attributes->width;
+    client->h = cold->old_h = window_attributes->height;
+    cold->old_border_pixels = window_attributes->border_width;
 
-    client_update_icon(client);
-    client_update_title(client);
+    client_read_icon(client, window_property_reply(cookies[PropertyIcon]));
+    client_read_title(client,
+                      window_property_reply(cookies[PropertyNetName]),
+                      window_property_reply(cookies[PropertyName]));
+    client_read_class(client, window_property_reply(cookies[PropertyClass]));
 
-    success = XGetTransientForHint(display, window, &trans_window);
-    if (success && (trans_client = window_to_client(trans_window))) {
+    if ((reply = window_property_reply(cookies[PropertyTransient]))) {
+        if (reply->format == 32)
+            trans_window = *(uint32 *)xcb_get_property_value(reply);
+        free(reply);
+    }
+    if (trans_window && (trans_client = window_to_client(trans_window))) {
         client->monitor = trans_client->monitor;
         client->tags = trans_client->tags;
     } else {
@@ -1527,6 +2988,7 @@ client_new(Window window, XWindowAttributes *window_attributes) {
     client->x = MAX(client->x, client->monitor->win_x);
     client->y = MAX(client->y, client->monitor->win_y);
     client->border_pixels = border_pixels;
+    client->window_border_pixels = client->border_pixels;
 
     window_changes.border_width = client->border_pixels;
     XConfigureWindow(display, window, CWBorderWidth, &window_changes);
@@ -1534,40 +2996,33 @@ client_new(Window window, XWindowAttributes *window_attributes) {
 
     /* propagates border_pixels, if size doesn'trans_client change */
     client_configure(client);
-    client_update_window_type(client);
-    client_update_size_hints(client);
-    client_update_wm_hints(client);
-    {
-        int actual_format_return;
-        ulong *prop_return;
-        ulong nitems_return;
-        ulong bytes_after_return;
-        Atom actual_type_return;
-
-        success = XGetWindowProperty(display, client->window,
-                                     net_atoms[NET_CLIENT_INFO],
-                                     0L, 2L, False, XA_CARDINAL,
-                                     &actual_type_return, &actual_format_return,
-                                     &nitems_return, &bytes_after_return,
-                                     (uchar **)&prop_return);
-        if (success == Success && nitems_return == 2) {
-            client->tags = (uint)*prop_return;
+    client_read_window_type(client,
+                            window_property_reply(cookies[PropertyState]),
+                            window_property_reply(cookies[PropertyWindowType]));
+    client_read_size_hints(client,
+                           window_property_reply(cookies[PropertyNormalHints]));
+    client_read_wm_hints(client, window_property_reply(cookies[PropertyHints]));
+
+    if ((reply = window_property_reply(cookies[PropertyClientInfo]))) {
+        uint32 *info = xcb_get_property_value(reply);
+
+        if (reply->format == 32 && reply->value_len == 2) {
+            client->tags = info[0];
             for (Monitor *mon = monitors; mon; mon = mon->next) {
-                if (mon->num == (int)*(prop_return + 1)) {
+                if (mon->num == (int)info[1]) {
                     client->monitor = mon;
                     break;
                 }
             }
         }
-        if (nitems_return > 0)
-            XFree(prop_return);
+        free(reply);
     }
     client_set_client_tag_prop(client);
 
-    client->stored_fx = client->x;
-    client->stored_fy = client->y;
-    client->stored_fw = client->w;
-    client->stored_fh = client->h;
+    cold->stored_fx = client->x;
+    cold->stored_fy = client->y;
+    cold->stored_fw = client->w;
+    cold->stored_fh = client->h;
 
     client_center(client);
 
@@ -1581,16 +3036,16 @@ client_new(Window window, XWindowAttributes *window_attributes) {
 
     if (!client->is_floating) {
         client->is_floating = trans_window != None || client->is_fixed;
-        client->old_state = client->is_floating;
+        cold->old_state = client->is_floating;
     }
     if (client->is_floating)
         XRaiseWindow(display, client->window);
 
     client_attach(client);
     client_attach_stack(client);
+    window_table_insert(&client_windows, client->window, client);
 
-    XChangeProperty(display, root, net_atoms[NET_CLIENT_LIST], XA_WINDOW,
-                    32, PropModeAppend, (uchar *)&(client->window), 1);
+    client_list_add(client->window);
 
     /* some windows require this */
     XMoveResizeWindow(display, client->window,
@@ -1616,9 +3071,10 @@ client_unmanage(Client *client, int destroyed) {
     client_detach(client);
     client_detach_stack(client);
     client_free_icon(client);
+    window_table_remove(&client_windows, client->window);
 
     if (!destroyed) {
-        window_changes.border_width = client->old_border_pixels;
+        window_changes.border_width = client_cold(client)->old_border_pixels;
         XGrabServer(display); /* avoid race conditions */
         XSetErrorHandler(handler_xerror_dummy);
 
@@ -1634,18 +3090,9 @@ client_unmanage(Client *client, int destroyed) {
         XUngrabServer(display);
     }
 
-    free(client);
+    client_list_remove(client->window);
+    client_release(client);
     client_focus(NULL);
-
-    XDeleteProperty(display, root, net_atoms[NET_CLIENT_LIST]);
-    for (Monitor *mon = monitors; mon; mon = mon->next) {
-        for (Client *c = mon->clients; c; c = c->next) {
-            XChangeProperty(display, root, net_atoms[NET_CLIENT_LIST],
-                            XA_WINDOW, 32, PropModeAppend,
-                            (uchar *)&(c->window), 1);
-        }
-    }
-
     monitor_arrange(monitor);
     return;
 }
@@ -1674,47 +3121,54 @@ client_pop(Client *client) {
 
 void
 client_resize(Client *client, int x, int y, int w, int h, bool interact) {
-    if (client_apply_size_hints(client, &x, &y, &w, &h, interact))
-        client_resize_apply(client, x, y, w, h);
+    client_apply_size_hints(client, &x, &y, &w, &h, interact);
+    client_resize_commit(client, x, y, w, h);
+    return;
+}
+
+/* Skips the request and the synthetic ConfigureNotify when the window
+ * already has the resulting geometry, which is the common case when
+ * layouts re-run after focus changes or bar redraws. */
+void
+client_resize_commit(Client *client, int x, int y, int w, int h) {
+    int border;
+    int extra;
+
+    border = client_window_border(client);
+    extra = 2*(client->border_pixels - border);
+    if (x == client->x && y == client->y
+        && w + extra == client->w && h + extra == client->h
+        && border == client->window_border_pixels) {
+        configures_skipped += 1;
+        return;
+    }
+    client_resize_apply(client, x, y, w, h);
     return;
 }
 
 void
 client_resize_apply(Client *client, int x, int y, int w, int h) {
+    ClientCold *cold = client_cold(client);
     XWindowChanges window_changes;
-    uint n = 0;
+    int border = client_window_border(client);
+    /* a dropped border is given to the window itself */
+    int extra = 2*(client->border_pixels - border);
 
-    client->old_x = client->x;
+    cold->old_x = client->x;
     client->x = window_changes.x = x;
-    client->old_y = client->y;
+    cold->old_y = client->y;
     client->y = window_changes.y = y;
 
-    client->old_w = client->w;
-    client->w = window_changes.width = w;
-    client->old_h = client->h;
-    client->h = window_changes.height = h;
-
-    window_changes.border_width = client->border_pixels;
-
-    for (Client *client_aux = client_next_tiled(live_monitor->clients);
-                 client_aux;
-                 client_aux = client_next_tiled(client_aux->next)) {
-        n += 1;
-    }
+    cold->old_w = client->w;
+    client->w = window_changes.width = w + extra;
+    cold->old_h = client->h;
+    client->h = window_changes.height = h + extra;
 
-    if (!(client->is_floating)) {
-        const Layout *layout = live_monitor->layout[live_monitor->lay_i];
-        if (layout->function == monitor_layout_monocle || n == 1) {
-            window_changes.border_width = 0;
-            client->w = window_changes.width += client->border_pixels*2;
-            client->h = window_changes.height += client->border_pixels*2;
-        }
-    }
+    client->window_border_pixels = window_changes.border_width = border;
 
     XConfigureWindow(display, client->window,
                      CWX|CWY|CWWidth|CWHeight|CWBorderWidth, &window_changes);
     client_configure(client);
-    XSync(display, False);
     return;
 }
 
@@ -1775,7 +3229,7 @@ client_send_event(Client *client, Atom proto) {
 
 void
 client_set_focus(Client *client) {
-    if (!client->never_focus) {
+    if (!client_cold(client)->never_focus) {
         XSetInputFocus(display, client->window,
                        RevertToPointerRoot, CurrentTime);
         XChangeProperty(display, root, net_atoms[NET_ACTIVE_WINDOW],
@@ -1788,6 +3242,7 @@ client_set_focus(Client *client) {
 
 void
 client_set_fullscreen(Client *client, bool fullscreen) {
+    ClientCold *cold = client_cold(client);
     if (fullscreen && !client->is_fullscreen) {
         XChangeProperty(display, client->window,
                         net_atoms[NET_WM_STATE], XA_ATOM, 32,
@@ -1799,10 +3254,11 @@ client_set_fullscreen(Client *client, bool fullscreen) {
                                 client->x, client->y, client->w, client->h);
             return;
         }
-        client->old_state = client->is_floating;
-        client->old_border_pixels = client->border_pixels;
+        cold->old_state = client->is_floating;
+        cold->old_border_pixels = client->border_pixels;
         client->border_pixels = 0;
         client->is_floating = true;
+        client_tags_changed(client);
 
         client_resize_apply(client,
                             client->monitor->mon_x, client->monitor->mon_y,
@@ -1818,13 +3274,14 @@ client_set_fullscreen(Client *client, bool fullscreen) {
                                 client->x, client->y, client->w, client->h);
             return;
         }
-        client->is_floating = client->old_state;
-        client->border_pixels = client->old_border_pixels;
+        client->is_floating = cold->old_state;
+        client->border_pixels = cold->old_border_pixels;
+        client_tags_changed(client);
 
-        client->x = client->old_x;
-        client->y = client->old_y;
-        client->w = client->old_w;
-        client->h = client->old_h;
+        client->x = cold->old_x;
+        client->y = cold->old_y;
+        client->w = cold->old_w;
+        client->h = cold->old_h;
 
         client_resize_apply(client, client->x, client->y, client->w, client->h);
         monitor_arrange(client->monitor);
@@ -1834,49 +3291,110 @@ client_set_fullscreen(Client *client, bool fullscreen) {
 
 void
 client_update_window_type(Client *client) {
-    Atom state;
-    Atom window_type;
+    xcb_get_property_cookie_t state;
+    xcb_get_property_cookie_t window_type;
+
+    state = window_property_request(client->window,
+                                    net_atoms[NET_WM_STATE], XA_ATOM, 1);
+    window_type = window_property_request(client->window,
+                                          net_atoms[NET_WM_WINDOW_TYPE],
+                                          XA_ATOM, 1);
+    client_read_window_type(client,
+                            window_property_reply(state),
+                            window_property_reply(window_type));
+    return;
+}
 
-    state = client_get_atom_property(client, net_atoms[NET_WM_STATE]);
-    window_type = client_get_atom_property(client,
-                                           net_atoms[NET_WM_WINDOW_TYPE]);
+void
+client_read_window_type(Client *client,
+                        xcb_get_property_reply_t *state_reply,
+                        xcb_get_property_reply_t *window_type_reply) {
+    Atom state = window_read_atom(state_reply);
+    Atom window_type = window_read_atom(window_type_reply);
 
     if (state == net_atoms[NET_WM_STATE_FULLSCREEN])
         client_set_fullscreen(client, true);
-    if (window_type == net_atoms[NET_WM_WINDOW_TYPE_DIALOG])
+    if (window_type == net_atoms[NET_WM_WINDOW_TYPE_DIALOG]) {
         client->is_floating = true;
+        client_tags_changed(client);
+    }
     return;
 }
 
 void
 client_update_wm_hints(Client *client) {
-    XWMHints *wm_hints;
+    xcb_get_property_cookie_t cookie;
+
+    cookie = window_property_request(client->window, XA_WM_HINTS,
+                                     XA_WM_HINTS, WM_HINTS_LENGTH);
+    client_read_wm_hints(client, window_property_reply(cookie));
+    return;
+}
+
+/* same layout and checks as XGetWMHints() */
+void
+client_read_wm_hints(Client *client, xcb_get_property_reply_t *reply) {
+    ClientCold *cold = client_cold(client);
+    XWMHints wm_hints = {0};
+    uint32 *value;
     bool urgent;
 
-    if (!(wm_hints = XGetWMHints(display, client->window)))
+    if (!reply)
         return;
+    if (reply->format != 32 || reply->value_len < WM_HINTS_LENGTH - 1) {
+        free(reply);
+        return;
+    }
 
-    urgent = wm_hints->flags & XUrgencyHint;
+    value = xcb_get_property_value(reply);
+    wm_hints.flags = (long)value[0];
+    wm_hints.input = (Bool)value[1];
+    wm_hints.initial_state = (int)value[2];
+    wm_hints.icon_pixmap = value[3];
+    wm_hints.icon_window = value[4];
+    wm_hints.icon_x = (int)value[5];
+    wm_hints.icon_y = (int)value[6];
+    wm_hints.icon_mask = value[7];
+    if (reply->value_len >= WM_HINTS_LENGTH)
+        wm_hints.window_group = value[8];
+    free(reply);
+
+    urgent = wm_hints.flags & XUrgencyHint;
     if (urgent && client == live_monitor->selected_client) {
-        wm_hints->flags &= ~XUrgencyHint;
-        XSetWMHints(display, client->window, wm_hints);
+        wm_hints.flags &= ~XUrgencyHint;
+        XSetWMHints(display, client->window, &wm_hints);
     } else {
-        client->is_urgent = urgent;
+        if (client->is_urgent != urgent) {
+            client->is_urgent = urgent;
+            client_tags_changed(client);
+        }
         if (client->is_urgent) {
             XSetWindowBorder(display, client->window,
                              scheme[SchemeUrgent][ColBorder].pixel);
         }
     }
 
-    if (wm_hints->flags & InputHint)
-        client->never_focus = !wm_hints->input;
+    if (wm_hints.flags & InputHint)
+        cold->never_focus = !wm_hints.input;
     else
-        client->never_focus = false;
-
-    XFree(wm_hints);
+        cold->never_focus = false;
     return;
 }
 
+int
+client_window_border(Client *client) {
+    Monitor *monitor = client->monitor;
+    const Layout *layout = monitor->layout[monitor->lay_i];
+
+    if (client->is_floating)
+        return client->border_pixels;
+    if (layout->function == monitor_layout_monocle
+        || monitor_tag_buckets(monitor)->number_tiled == 1) {
+        return 0;
+    }
+    return client->border_pixels;
+}
+
 int
 client_pixels_width(Client *client) {
     int width = client->w + 2*client->border_pixels;
@@ -1889,6 +3407,15 @@ client_pixels_height(Client *client) {
     return height;
 }
 
+/* anything the tag buckets are built from: list membership, tags,
+ * floating, urgency, icon or class */
+void
+client_tags_changed(Client *client) {
+    if (client->monitor)
+        client->monitor->buckets->valid = false;
+    return;
+}
+
 bool
 client_is_visible(Client *client) {
     Monitor *monitor = client->monitor;
@@ -1900,7 +3427,10 @@ void
 client_set_urgent(Client *client, bool urgent) {
     XWMHints *wm_hints;
 
-    client->is_urgent = urgent;
+    if (client->is_urgent != urgent) {
+        client->is_urgent = urgent;
+        client_tags_changed(client);
+    }
     if (!(wm_hints = XGetWMHints(display, client->window)))
         return;
 
@@ -1914,40 +3444,6 @@ client_set_urgent(Client *client, bool urgent) {
     return;
 }
 
-void
-client_show_hide(Client *client) {
-    Monitor *mon;
-    if (client == NULL)
-        return;
-
-    mon = client->monitor;
-
-    if (client_is_visible(client)) {
-        bool monitor_floating;
-
-        if ((client->tags) && client->is_floating)
-            client_center(client);
-
-        /* show clients top down */
-        XMoveWindow(display, client->window, client->x, client->y);
-
-        monitor_floating = !mon->layout[mon->lay_i]->function;
-        if ((monitor_floating || client->is_floating)
-            && (!client->is_fullscreen || client->is_fake_fullscreen)) {
-            client_resize(client,
-                          client->x, client->y, client->w, client->h,
-                          false);
-        }
-        client_show_hide(client->stack_next);
-    } else {
-        /* hide clients bottom up */
-        client_show_hide(client->stack_next);
-        XMoveWindow(display, client->window,
-                    -2*client_pixels_width(client), client->y);
-    }
-    return;
-}
-
 void
 client_set_client_tag_prop(Client *client) {
     long data[] = {
@@ -1962,92 +3458,194 @@ client_set_client_tag_prop(Client *client) {
 
 void
 client_free_icon(Client *client) {
-    if (client->icon) {
-        XRenderFreePicture(display, client->icon);
-        client->icon = None;
+    ClientCold *cold = client_cold(client);
+    if (cold->icon) {
+        icon_release(cold->icon);
+        cold->icon = None;
+        client_tags_changed(client);
     }
     return;
 }
 
 void
-client_unfocus(Client *client, bool set_focus) {
-    if (client == NULL)
-        return;
+icon_release(Picture picture) {
+    IconEntry **entry;
 
-    client_grab_buttons(client, false);
-    XSetWindowBorder(display, client->window,
-                     scheme[SchemeNormal][ColBorder].pixel);
+    for (entry = &icons; *entry; entry = &(*entry)->next) {
+        IconEntry *icon = *entry;
 
-    if (set_focus) {
-        XSetInputFocus(display, root, RevertToPointerRoot, CurrentTime);
-        XDeleteProperty(display, root, net_atoms[NET_ACTIVE_WINDOW]);
-    }
-    return;
+        if (icon->picture != picture)
+            continue;
+        if (--icon->references == 0) {
+            XRenderFreePicture(display, icon->picture);
+            *entry = icon->next;
+            free(icon);
+        }
+        return;
+    }
+    return;
+}
+
+/* FNV-1a of the pixels, and in check a multiply-xorshift one, so that
+ * sharing a cached icon takes two independent 64 bit matches */
+uint64
+icon_hash(const uint32 *pixels, uint32 count, uint32 w, uint32 h,
+          uint64 *check) {
+    uint64 hash = 0xCBF29CE484222325u ^ ((uint64)w << 32 | h);
+    uint64 second = 0x9E3779B97F4A7C15u ^ count;
+
+    for (uint32 i = 0; i < count; i += 1) {
+        hash ^= pixels[i];
+        hash *= 0x100000001B3u;
+        second = (second ^ pixels[i])*0xBF58476D1CE4E5B9u;
+        second ^= second >> 31;
+    }
+    *check = second;
+    return hash;
+}
+
+/* ARGB to premultiplied ARGB in place, four pixels at a time */
+void
+icon_premultiply(uint32 *pixels, uint32 count) {
+    uint32 i = 0;
+
+#if defined(__GNUC__) || defined(__clang__)
+    for (; i + 4 <= count; i += 4) {
+        uint32x4 pixel;
+        uint32x4 a;
+        uint32x4 rb;
+        uint32x4 g;
+
+        memcpy(&pixel, &pixels[i], sizeof(pixel));
+        a = pixel >> 24u;
+        rb = (a*(pixel & 0xFF00FFu)) >> 8u;
+        g = (a*(pixel & 0x00FF00u)) >> 8u;
+        pixel = (rb & 0xFF00FFu) | (g & 0x00FF00u) | (a << 24u);
+        memcpy(&pixels[i], &pixel, sizeof(pixel));
+    }
+#endif
+    for (; i < count; i += 1) {
+        uint32 pixel = pixels[i];
+        uint32 a = pixel >> 24u;
+        uint32 rb = (a*(pixel & 0xFF00FFu)) >> 8u;
+        uint32 g = (a*(pixel & 0x00FF00u)) >> 8u;
+        pixels[i] = (rb & 0xFF00FFu) | (g & 0x00FF00u) | (a << 24u);
+    }
+    return;
+}
+
+void
+client_unfocus(Client *client, bool set_focus) {
+    if (client == NULL)
+        return;
+
+    client_grab_buttons(client, false);
+    XSetWindowBorder(display, client->window,
+                     scheme[SchemeNormal][ColBorder].pixel);
+
+    if (set_focus) {
+        XSetInputFocus(display, root, RevertToPointerRoot, CurrentTime);
+        XDeleteProperty(display, root, net_atoms[NET_ACTIVE_WINDOW]);
+    }
+    return;
 }
 
 void
 client_update_size_hints(Client *client) {
-    long supplied_return;
+    xcb_get_property_cookie_t cookie;
+
+    cookie = window_property_request(client->window, XA_WM_NORMAL_HINTS,
+                                     XA_WM_SIZE_HINTS, SIZE_HINTS_LENGTH);
+    client_read_size_hints(client, window_property_reply(cookie));
+    return;
+}
+
+/* same layout and checks as XGetWMNormalHints() */
+void
+client_read_size_hints(Client *client, xcb_get_property_reply_t *reply) {
+    SizeHints *hints = &client_cold(client)->hints;
     bool has_maxes;
     bool mins_match_maxes;
-    XSizeHints size_hints;
-    int success;
-
-    success = XGetWMNormalHints(display, client->window,
-                                &size_hints, &supplied_return);
-    if (!success) {
-        /* size_hints is uninitialized,
-         * ensure that size_hints.flags aren't used */
-        size_hints.flags = PSize;
+    /* ensure that size_hints.flags aren't used without the property */
+    XSizeHints size_hints = { .flags = PSize };
+
+    if (reply && reply->format == 32
+        && reply->value_len >= SIZE_HINTS_OLD_LENGTH) {
+        uint32 *value = xcb_get_property_value(reply);
+
+        size_hints.flags = (long)value[0];
+        size_hints.min_width = (int)value[5];
+        size_hints.min_height = (int)value[6];
+        size_hints.max_width = (int)value[7];
+        size_hints.max_height = (int)value[8];
+        size_hints.width_inc = (int)value[9];
+        size_hints.height_inc = (int)value[10];
+        size_hints.min_aspect.x = (int)value[11];
+        size_hints.min_aspect.y = (int)value[12];
+        size_hints.max_aspect.x = (int)value[13];
+        size_hints.max_aspect.y = (int)value[14];
+        if (reply->value_len >= SIZE_HINTS_LENGTH) {
+            size_hints.base_width = (int)value[15];
+            size_hints.base_height = (int)value[16];
+            size_hints.win_gravity = (int)value[17];
+        } else {
+            size_hints.flags &= ~(PBaseSize|PWinGravity);
+        }
     }
+    free(reply);
 
     if (size_hints.flags & PBaseSize) {
-        client->base_w = size_hints.base_width;
-        client->base_h = size_hints.base_height;
+        hints->base_w = size_hints.base_width;
+        hints->base_h = size_hints.base_height;
     } else if (size_hints.flags & PMinSize) {
-        client->base_w = size_hints.min_width;
-        client->base_h = size_hints.min_height;
+        hints->base_w = size_hints.min_width;
+        hints->base_h = size_hints.min_height;
     } else {
-        client->base_w = client->base_h = 0;
+        hints->base_w = hints->base_h = 0;
     }
 
     if (size_hints.flags & PResizeInc) {
-        client->increment_w = size_hints.width_inc;
-        client->increment_h = size_hints.height_inc;
+        hints->increment_w = size_hints.width_inc;
+        hints->increment_h = size_hints.height_inc;
     } else {
-        client->increment_w = client->increment_h = 0;
+        hints->increment_w = hints->increment_h = 0;
     }
 
     if (size_hints.flags & PMaxSize) {
-        client->max_w = size_hints.max_width;
-        client->max_h = size_hints.max_height;
+        hints->max_w = size_hints.max_width;
+        hints->max_h = size_hints.max_height;
     } else {
-        client->max_w = client->max_h = 0;
+        hints->max_w = hints->max_h = 0;
     }
 
     if (size_hints.flags & PMinSize) {
-        client->min_w = size_hints.min_width;
-        client->min_h = size_hints.min_height;
+        hints->min_w = size_hints.min_width;
+        hints->min_h = size_hints.min_height;
     } else if (size_hints.flags & PBaseSize) {
-        client->min_w = size_hints.base_width;
-        client->min_h = size_hints.base_height;
+        hints->min_w = size_hints.base_width;
+        hints->min_h = size_hints.base_height;
     } else {
-        client->min_w = client->min_h = 0;
+        hints->min_w = hints->min_h = 0;
     }
 
     if (size_hints.flags & PAspect) {
         float aspect_x = (float)size_hints.min_aspect.x;
         float aspect_y = (float)size_hints.min_aspect.y;
-        client->min_aspect = aspect_y / aspect_x;
-        client->max_aspect = aspect_x / aspect_y;
+        hints->min_aspect = aspect_y / aspect_x;
+        hints->max_aspect = aspect_x / aspect_y;
     } else {
-        client->max_aspect = client->min_aspect = 0.0;
+        hints->max_aspect = hints->min_aspect = 0.0;
     }
 
-    has_maxes = client->max_w && client->max_h;
-    mins_match_maxes = client->max_w == client->min_w
-                       && client->max_h == client->min_h;
+    has_maxes = hints->max_w && hints->max_h;
+    mins_match_maxes = hints->max_w == hints->min_w
+                       && hints->max_h == hints->min_h;
     client->is_fixed = has_maxes && mins_match_maxes;
+    client->has_hints = hints->base_w || hints->base_h
+                        || hints->min_w || hints->min_h
+                        || hints->max_w || hints->max_h
+                        || hints->increment_w || hints->increment_h
+                        || hints->min_aspect > 0 || hints->max_aspect > 0;
 
     client->hintsvalid = true;
     return;
@@ -2055,143 +3653,260 @@ client_update_size_hints(Client *client) {
 
 void
 client_update_title(Client *client) {
-    if (!window_text_property(client->window, net_atoms[NET_WM_NAME],
-                              client->name, sizeof(client->name))) {
-        window_text_property(client->window, XA_WM_NAME,
-                             client->name, sizeof(client->name));
+    ClientCold *cold = client_cold(client);
+    xcb_get_property_cookie_t net_name;
+    xcb_get_property_cookie_t name;
+
+    net_name = window_property_request(client->window,
+                                       net_atoms[NET_WM_NAME],
+                                       AnyPropertyType, sizeof(cold->name));
+    name = window_property_request(client->window, XA_WM_NAME,
+                                   AnyPropertyType, sizeof(cold->name));
+    client_read_title(client,
+                      window_property_reply(net_name),
+                      window_property_reply(name));
+    return;
+}
+
+void
+client_read_title(Client *client,
+                  xcb_get_property_reply_t *net_name_reply,
+                  xcb_get_property_reply_t *name_reply) {
+    ClientCold *cold = client_cold(client);
+    if (window_read_text(net_name_reply, cold->name, sizeof(cold->name)))
+        free(name_reply);
+    else
+        window_read_text(name_reply, cold->name, sizeof(cold->name));
+
+    if (cold->name[0] == '\0')
+        strcpy(cold->name, broken);
+    return;
+}
+
+void
+client_update_class(Client *client) {
+    xcb_get_property_cookie_t cookie;
+
+    cookie = window_property_request(client->window, XA_WM_CLASS,
+                                     XA_STRING, CLASS_SIZE);
+    client_read_class(client, window_property_reply(cookie));
+    return;
+}
+
+/* WM_CLASS holds the instance and then the class,
+ * each terminated by a null byte */
+void
+client_read_class(Client *client, xcb_get_property_reply_t *reply) {
+    ClientCold *cold = client_cold(client);
+    char instance[sizeof(cold->instance)] = "";
+    char class[sizeof(cold->class)] = "";
+
+    if (reply && reply->format == 8) {
+        const char *value = xcb_get_property_value(reply);
+        int length = xcb_get_property_value_length(reply);
+        int n = (int)strnlen(value, (size_t)length);
+
+        snprintf(instance, sizeof(instance), "%.*s", n, value);
+        if (n + 1 < length) {
+            const char *value_class = value + n + 1;
+            int class_n = (int)strnlen(value_class, (size_t)(length - n - 1));
+            snprintf(class, sizeof(class), "%.*s", class_n, value_class);
+        }
+    }
+    free(reply);
+
+    if (strcmp(instance, cold->instance) || strcmp(class, cold->class)) {
+        memcpy(cold->instance, instance, sizeof(instance));
+        memcpy(cold->class, class, sizeof(class));
+        client_tags_changed(client);
     }
-    if (client->name[0] == '\0')
-        strcpy(client->name, broken);
     return;
 }
 
 void
 client_update_icon(Client *client) {
-    Window window = client->window;
-    Atom actual_type_return;
-    int actual_format_return;
-    ulong nitems_return;
-    ulong bytes_after_return;
-    ulong *prop_return = NULL;
-
-    ulong *pixel_find = NULL;
-    uint32 *pixel_find32;
-    uint32 width_find, height_find;
+    xcb_get_property_cookie_t cookie;
+
+    cookie = window_property_request(client->window, net_atoms[NET_WM_ICON],
+                                     AnyPropertyType, ICON_PREFIX_LENGTH);
+    client_read_icon(client, window_property_reply(cookie));
+    return;
+}
+
+/* Keeps the previous icon referenced while the new one is read, so an
+ * unchanged icon comes back from the cache as the same picture and the
+ * tag buckets stay valid. */
+void
+client_read_icon(Client *client, xcb_get_property_reply_t *reply) {
+    ClientCold *cold = client_cold(client);
+    Picture previous = cold->icon;
+
+    cold->icon = None;
+    client_load_icon(client, reply);
+    if (previous)
+        icon_release(previous);
+    if (cold->icon != previous)
+        client_tags_changed(client);
+    return;
+}
+
+/* The reply holds the first ICON_PREFIX_LENGTH units of _NET_WM_ICON,
+ * which is all of it for most clients. Of a longer property the rest is
+ * read in one more request, up to ICON_MAX_LENGTH units in all, and the
+ * best image is picked among those that fit. */
+void
+client_load_icon(Client *client, xcb_get_property_reply_t *reply) {
+    ClientCold *cold = client_cold(client);
+    IconImage images[ICON_MAX_IMAGES];
+    IconImage *best = NULL;
+    void *owned;
+    uint32 *values;
+    uint32 *pixels;
+    uint32 total_length;
+    uint32 offset = 0;
+    uint32 area;
     uint32 icon_width, icon_height;
-    uint32 area_find = 0;
-    uint *picture_width = &client->icon_width;
-    uint *picture_height = &client->icon_height;
-    int success;
+    uint64 hash;
+    uint64 check;
+    int number_images = 0;
 
-    client_free_icon(client);
-    success = XGetWindowProperty(display, window, net_atoms[NET_WM_ICON],
-                                 0L, LONG_MAX, False, AnyPropertyType,
-                                 &actual_type_return, &actual_format_return,
-                                 &nitems_return, &bytes_after_return,
-                                 (uchar **)&prop_return);
-    if (success != Success)
+    if (!reply)
         return;
-
-    if (nitems_return == 0 || actual_format_return != 32) {
-        XFree(prop_return);
+    if (reply->format != 32) {
+        free(reply);
         return;
     }
+    values = xcb_get_property_value(reply);
+    total_length = reply->value_len;
+    owned = reply;
+    if (reply->bytes_after && total_length < ICON_MAX_LENGTH) {
+        uint32 wanted = MIN(reply->bytes_after/4,
+                            ICON_MAX_LENGTH - total_length);
+        xcb_get_property_reply_t *rest;
+
+        rest = window_property_reply(
+                   xcb_get_property(xcb_connection, 0,
+                                    (xcb_window_t)client->window,
+                                    (xcb_atom_t)net_atoms[NET_WM_ICON],
+                                    XCB_GET_PROPERTY_TYPE_ANY,
+                                    total_length, wanted));
+        if (rest && rest->format == 32 && rest->value_len) {
+            uint32 *joined = xcalloc((size_t)total_length + rest->value_len,
+                                     sizeof(*joined));
+
+            memcpy(joined, values, total_length*sizeof(*joined));
+            memcpy(joined + total_length, xcb_get_property_value(rest),
+                   rest->value_len*sizeof(*joined));
+            total_length += rest->value_len;
+            values = joined;
+            owned = joined;
+            free(reply);
+        }
+        free(rest);
+    }
 
-    do {
-        ulong *pointer = prop_return;
-        const ulong *end = prop_return + nitems_return;
-        uint32 bstd = UINT32_MAX;
-        uint32 d;
-
-        while (pointer < (end - 1)) {
-            uint32 max_dim;
-            uint32 w = (uint32)*pointer++;
-            uint32 h = (uint32)*pointer++;
-
-            if (w >= 16384 || h >= 16384) {
-                XFree(prop_return);
-                return;
-            }
-            if ((area_find = w*h) > (end - pointer))
-                break;
+    while (offset + 2 <= total_length && number_images < ICON_MAX_IMAGES) {
+        IconImage *image = &images[number_images];
 
-            max_dim = w > h ? w : h;
-            if (max_dim >= ICONSIZE && (d = max_dim - ICONSIZE) < bstd) {
-                bstd = d;
-                pixel_find = pointer;
-            }
-            pointer += area_find;
-        }
+        image->w = values[offset];
+        image->h = values[offset + 1];
 
-        if (pixel_find)
+        if (image->w >= ICON_MAX_DIMENSION || image->h >= ICON_MAX_DIMENSION) {
+            free(owned);
+            return;
+        }
+        area = image->w*image->h;
+        if (area > total_length - offset - 2)
             break;
 
-        pointer = prop_return;
-        while (pointer < (end - 1)) {
-            uint32 max_dim;
-            uint32 w = (uint32)*pointer++;
-            uint32 h = (uint32)*pointer++;
+        image->offset = offset;
+        number_images += 1;
+        offset += 2 + area;
+    }
 
-            if (w >= 16384 || h >= 16384) {
-                XFree(prop_return);
-                return;
-            }
-            if ((area_find = w*h) > (end - pointer))
-                break;
+    /* the smallest image not below ICONSIZE, else the largest one */
+    for (int i = 0; i < number_images; i += 1) {
+        IconImage *image = &images[i];
+        uint32 max_dim = MAX(image->w, image->h);
+        uint32 best_dim;
 
-            max_dim = w > h ? w : h;
-            if ((d = ICONSIZE - max_dim) < bstd) {
-                bstd = d;
-                pixel_find = pointer;
-            }
-            pointer += area_find;
+        if (!image->w || !image->h)
+            continue;
+        if (!best) {
+            best = image;
+            continue;
+        }
+        best_dim = MAX(best->w, best->h);
+        if (max_dim >= ICONSIZE) {
+            if (best_dim < ICONSIZE || max_dim < best_dim)
+                best = image;
+        } else if (best_dim < ICONSIZE && max_dim > best_dim) {
+            best = image;
         }
-    } while (false);
-
-    if (!pixel_find) {
-        XFree(prop_return);
-        return;
     }
-
-    width_find = (uint32)pixel_find[-2];
-    height_find = (uint32)pixel_find[-1];
-    if ((width_find == 0) || (height_find == 0)) {
-        XFree(prop_return);
+    if (!best) {
+        free(owned);
         return;
     }
 
-    if (width_find <= height_find) {
+    area = best->w*best->h;
+    pixels = values + best->offset + 2;
+
+    if (best->w <= best->h) {
         icon_height = ICONSIZE;
-        icon_width = width_find*ICONSIZE / height_find;
+        icon_width = best->w*ICONSIZE / best->h;
         if (icon_width == 0)
             icon_width = 1;
     } else {
         icon_width = ICONSIZE;
-        icon_height = height_find*ICONSIZE / width_find;
+        icon_height = best->h*ICONSIZE / best->w;
         if (icon_height == 0)
             icon_height = 1;
     }
-    *picture_width = icon_width;
-    *picture_height = icon_height;
 
-    pixel_find32 = (uint32 *)pixel_find;
-    for (uint32 i = 0; i < width_find*height_find; i += 1) {
-        uint32 pixel = (uint32)pixel_find[i];
-        uint8 a = pixel >> 24u;
-        uint32 rb = (a*(pixel & 0xFF00FFu)) >> 8u;
-        uint32 g = (a*(pixel & 0x00FF00u)) >> 8u;
-        pixel_find32[i] = (rb & 0xFF00FFu) | (g & 0x00FF00u) | ((uint)a << 24u);
+    hash = icon_hash(pixels, area, best->w, best->h, &check);
+    for (IconEntry *icon = icons; icon; icon = icon->next) {
+        if (icon->hash == hash && icon->check == check
+            && icon->source_width == best->w
+            && icon->source_height == best->h) {
+            icon->references += 1;
+            cold->icon = icon->picture;
+            cold->icon_width = icon->icon_width;
+            cold->icon_height = icon->icon_height;
+            free(owned);
+            return;
+        }
     }
 
-    client->icon = drw_picture_create_resized(drw, (char *)pixel_find,
-                                              width_find, height_find,
+    icon_premultiply(pixels, area);
+    cold->icon = drw_picture_create_resized(drw, (char *)pixels,
+                                              best->w, best->h,
                                               icon_width, icon_height);
-    XFree(prop_return);
+    cold->icon_width = icon_width;
+    cold->icon_height = icon_height;
+
+    if (cold->icon) {
+        IconEntry *icon = xcalloc(1, sizeof(*icon));
+
+        icon->hash = hash;
+        icon->check = check;
+        icon->picture = cold->icon;
+        icon->source_width = best->w;
+        icon->source_height = best->h;
+        icon->icon_width = icon_width;
+        icon->icon_height = icon_height;
+        icon->references = 1;
+        icon->next = icons;
+        icons = icon;
+    }
+
+    free(owned);
     return;
 }
 
 void
 monitor_arrange_monitor(Monitor *monitor) {
+    STATS_COUNT(StatsArrange);
     strncpy(monitor->layout_symbol,
             monitor->layout[monitor->lay_i]->symbol,
             sizeof(monitor->layout_symbol));
@@ -2219,359 +3934,428 @@ monitor_cleanup_monitor(Monitor *monitor) {
         monitor_aux->next = monitor->next;
     }
     XUnmapWindow(display, monitor->top_bar_window);
+    window_table_remove(&bar_windows, monitor->top_bar_window);
+    window_table_remove(&bar_windows, monitor->bottom_bar_window);
 
     XDestroyWindow(display, monitor->top_bar_window);
     XDestroyWindow(display, monitor->bottom_bar_window);
 
+    for (int i = 0; i < 2; i += 1) {
+        Drw *bar_drw = monitor->bars[i].drw;
+        if (bar_drw) {
+            /* the fontset is shared with the global drw */
+            bar_drw->fonts = NULL;
+            drw_free(bar_drw);
+        }
+    }
+    free(monitor->bars);
     free(monitor->pertag);
+    free(monitor->buckets->visible);
+    free(monitor->buckets);
     free(monitor);
     return;
 }
 
 void
 monitor_draw_bars(Monitor *monitor) {
-    int draw_x;
-    int w;
-    int text_pixels = 0;
-    int urgent = 0;
-    uint padding = (uint)text_padding/2;
-    char tags_display[TAG_DISPLAY_SIZE] = {0};
-    char *masters_names[LENGTH(tags)] = {0};
-    Client *clients_with_icon[LENGTH(tags)] = {0};
-
-    if (!monitor->show_top_bar)
-        return;
+    STATS_COUNT(StatsDrawBars);
+    if (monitor->show_top_bar)
+        monitor_draw_top_bar(monitor);
+    if (monitor->show_bottom_bar)
+        monitor_draw_bottom_bar(monitor);
+    return;
+}
 
-    /* bottom bar */
-    drw_setscheme(drw, scheme[SchemeNormal]);
-    drw_rect(drw, 0, 0, (uint)monitor->win_w, bar_height, true, true);
-    if (monitor == live_monitor)
-        draw_status_text(&status_bottom, monitor->win_w);
-    drw_map(drw, monitor->bottom_bar_window,
-            0, 0, (uint)monitor->win_w, bar_height);
+void
+monitor_draw_bottom_bar(Monitor *monitor) {
+    Bar *bar = &monitor->bars[BarBottom];
+    int width = monitor->win_w;
+    int status_x0 = width;
+    int status_x1 = width;
 
-    /* top bar: draw status first so it can be overdrawn by tags later */
-    /* only drawn status on selected monitor */
+    bar_begin(bar, width);
     if (monitor == live_monitor) {
-        drw_setscheme(drw, scheme[SchemeNormal]);
-
-        draw_status_text(&status_top, monitor->win_w);
-        text_pixels = status_top.pixels;
+        status_x0 = (width - status_bottom.pixels)/2;
+        status_x1 = status_x0 + status_bottom.pixels;
+        draw_status_text(bar, &status_bottom, status_x0);
+    } else {
+        memset(bar->status, 0, sizeof(bar->status));
     }
 
-    for (Client *client = monitor->clients; client; client = client->next) {
-        if (client->is_urgent)
-            urgent |= client->tags;
+    drw_setscheme(bar->drw, scheme[SchemeNormal]);
+    status_x0 = MAX(status_x0, 0);
+    if (bar_segment(bar, &bar->fills[0], 0, status_x0, BAR_HASH_SEED))
+        drw_rect(bar->drw, 0, 0, (uint)status_x0, bar_height, true, true);
+    if (bar_segment(bar, &bar->fills[1],
+                    status_x1, width - status_x1, BAR_HASH_SEED)) {
+        drw_rect(bar->drw,
+                 status_x1, 0, (uint)(width - status_x1), bar_height,
+                 true, true);
+    }
 
-        for (int i = 0; i < LENGTH(tags); i += 1) {
-            if (client->icon && client->tags & (1 << i))
-                clients_with_icon[i] = client;
+    bar_end(bar, monitor->bottom_bar_window, width);
+    return;
+}
 
-            if (!masters_names[i] && client->tags & (1<<i)) {
-                XClassHint class_hint = { NULL, NULL };
-                XGetClassHint(display, client->window, &class_hint);
-                masters_names[i] = class_hint.res_class;
-            }
-        }
-    }
+void
+monitor_draw_top_bar(Monitor *monitor) {
+    Bar *bar = &monitor->bars[BarTop];
+    Drw *bar_drw = bar->drw;
+    Client *selected = monitor->selected_client;
+    char title[NAME_SIZE + 16];
+    int width = monitor->win_w;
+    int status_x = width;
+    int draw_x;
+    int w;
+    uint padding = (uint)text_padding/2;
+    uint64 hash;
+    char tags_display[LENGTH(tags)][TAG_DISPLAY_SIZE];
+    int tags_pixels[LENGTH(tags)];
+    TagBuckets *buckets = monitor_tag_buckets(monitor);
+    uint urgent = buckets->urgent;
+    const char **masters_names = buckets->masters_names;
+    Client **clients_with_icon = buckets->icon_owners;
+    DrwText runs[LENGTH(tags)*2];
+    size_t number_runs = 0;
+    bool icons_dirty[LENGTH(tags)] = {0};
+    bool overlapped;
 
     draw_x = 0;
     for (int i = 0; i < LENGTH(tags); i += 1) {
-        Client *client_with_icon = clients_with_icon[i];
-        char *master_name = masters_names[i];
+        const char *master_name = masters_names[i];
 
         if (master_name) {
-            if (client_with_icon) {
-                snprintf(tags_display, sizeof(tags_display), "%s", tags[i]);
+            if (clients_with_icon[i]) {
+                snprintf(tags_display[i], sizeof(tags_display[i]),
+                         "%s", tags[i]);
             } else {
-                ulong n = strcspn(master_name, tag_label_delim);
-                master_name[n] = '\0';
-                snprintf(tags_display, sizeof(tags_display),
-                         tag_label_format, tags[i], master_name);
+                char label[CLASS_SIZE];
+                int n = (int)strcspn(master_name, tag_label_delim);
+                snprintf(label, sizeof(label), "%.*s", n, master_name);
+                snprintf(tags_display[i], sizeof(tags_display[i]),
+                         tag_label_format, tags[i], label);
             }
         } else {
-            snprintf(tags_display, sizeof(tags_display),
+            snprintf(tags_display[i], sizeof(tags_display[i]),
                      tag_empty_format, tags[i]);
         }
-        tags_widths[i] = w = get_text_pixels(tags_display);
+        tags_pixels[i] = get_text_pixels(tags_display[i]);
+        draw_x += tags_pixels[i];
+        if (clients_with_icon[i])
+            draw_x += (int)(client_cold(clients_with_icon[i])->icon_width
+                            + padding);
+    }
+    draw_x += get_text_pixels(monitor->layout_symbol);
 
-        if (monitor->tagset[monitor->selected_tags] & 1 << i)
-            drw_setscheme(drw, scheme[SchemeSelected]);
-        else
-            drw_setscheme(drw, scheme[SchemeNormal]);
+    bar_begin(bar, width);
 
-        drw_text(drw,
-                 draw_x, 0, (uint)w, bar_height,
-                 padding, tags_display, urgent & 1 << i);
-        draw_x += w;
+    /* only drawn status on selected monitor */
+    if (monitor == live_monitor)
+        status_x = width - status_top.pixels;
+
+    /* labels running into the status are painted over it, so everything
+     * has to be repainted in order, and once more when they stop to
+     * clear what they left over the status */
+    overlapped = draw_x > status_x;
+    if (overlapped || bar->overlapped)
+        bar_invalidate(bar);
+    bar->overlapped = overlapped;
+
+    if (monitor == live_monitor)
+        draw_status_text(bar, &status_top, status_x);
+    else
+        memset(bar->status, 0, sizeof(bar->status));
 
+    draw_x = 0;
+    for (int i = 0; i < LENGTH(tags); i += 1) {
+        Client *client_with_icon = clients_with_icon[i];
+        ClientCold *cold;
+        int is_selected = (monitor->tagset[monitor->selected_tags] & 1 << i) != 0;
+        int is_urgent = (urgent & 1 << i) != 0;
+
+        w = tags_pixels[i];
+        hash = bar_hash(BAR_HASH_SEED, tags_display[i], strlen(tags_display[i]));
+        hash = bar_hash(hash, &is_selected, sizeof(is_selected));
+        hash = bar_hash(hash, &is_urgent, sizeof(is_urgent));
         if (client_with_icon) {
-            Picture icon = client_with_icon->icon;
-            uint icon_width = client_with_icon->icon_width;
-            uint icon_height = client_with_icon->icon_height;
-
-            drw_text(drw,
-                     draw_x, 0, icon_width + padding, bar_height, 0,
-                     " ", urgent & 1 << i);
-            drw_pic(drw,
-                    draw_x, (bar_height - icon_height) / 2,
-                    icon_width, icon_height,
-                    icon);
-            draw_x += icon_width + padding;
-            tags_widths[i] += icon_width + padding;
+            cold = client_cold(client_with_icon);
+            hash = bar_hash(hash, &cold->icon, sizeof(cold->icon));
+            hash = bar_hash(hash, &cold->icon_width, sizeof(cold->icon_width));
+            hash = bar_hash(hash, &cold->icon_height,
+                            sizeof(cold->icon_height));
+            w += (int)(cold->icon_width + padding);
+        }
+
+        if (bar_segment(bar, &bar->tags[i], draw_x, w, hash)) {
+            Clr *tag_scheme = scheme[is_selected ? SchemeSelected : SchemeNormal];
+
+            runs[number_runs] = (DrwText){
+                .x = draw_x, .y = 0,
+                .w = (uint)tags_pixels[i], .h = bar_height,
+                .lpad = padding,
+                .text = tags_display[i],
+                .scheme = tag_scheme,
+                .invert = is_urgent,
+            };
+            number_runs += 1;
+
+            if (client_with_icon) {
+                runs[number_runs] = (DrwText){
+                    .x = draw_x + tags_pixels[i], .y = 0,
+                    .w = cold->icon_width + padding,
+                    .h = bar_height,
+                    .lpad = 0,
+                    .text = " ",
+                    .scheme = tag_scheme,
+                    .invert = is_urgent,
+                };
+                number_runs += 1;
+                icons_dirty[i] = true;
+            }
         }
+        draw_x += w;
     }
-    w = get_text_pixels(monitor->layout_symbol);
-    drw_setscheme(drw, scheme[SchemeNormal]);
-    draw_x = drw_text(drw,
-                      draw_x, 0, (uint)w, bar_height, padding,
-                      monitor->layout_symbol, false);
+    drw_texts(bar_drw, runs, number_runs);
 
-    if ((w = monitor->win_w - text_pixels - draw_x) > (int)bar_height) {
-        int boxs = drw->fonts->h / 9;
-        int boxw = drw->fonts->h / 6 + 2;
+    /* icons go on top of the backgrounds drawn above */
+    for (int i = 0; i < LENGTH(tags); i += 1) {
+        ClientCold *cold;
+        uint icon_height;
 
-        if (monitor->selected_client) {
-            if (monitor == live_monitor)
-                drw_setscheme(drw, scheme[SchemeSelected]);
+        if (!icons_dirty[i])
+            continue;
+
+        cold = client_cold(clients_with_icon[i]);
+        icon_height = cold->icon_height;
+        drw_pic(bar_drw,
+                bar->tags[i].x + tags_pixels[i],
+                (bar_height - icon_height) / 2,
+                cold->icon_width, icon_height,
+                cold->icon);
+    }
+
+    w = get_text_pixels(monitor->layout_symbol);
+    hash = bar_hash(BAR_HASH_SEED, monitor->layout_symbol,
+                    strlen(monitor->layout_symbol));
+    if (bar_segment(bar, &bar->layout_symbol, draw_x, w, hash)) {
+        drw_setscheme(bar_drw, scheme[SchemeNormal]);
+        drw_text(bar_drw,
+                 draw_x, 0, (uint)w, bar_height, padding,
+                 monitor->layout_symbol, false);
+    }
+    draw_x += w;
+
+    /* an alt-tab in progress previews its candidate as the title */
+    if (alt_tab.active && monitor == live_monitor
+        && alt_tab.clients[alt_tab.selected]) {
+        selected = alt_tab.clients[alt_tab.selected];
+        snprintf(title, sizeof(title), "[%d/%d] %s", alt_tab.selected + 1,
+                 alt_tab.number_clients, client_cold(selected)->name);
+    } else if (selected) {
+        snprintf(title, sizeof(title), "%s", client_cold(selected)->name);
+    }
+
+    w = MAX(status_x - draw_x, 0);
+    if (selected && w > (int)bar_height) {
+        int is_live = monitor == live_monitor;
+        int state[2] = { selected->is_floating, selected->is_fixed };
+
+        hash = bar_hash(BAR_HASH_SEED, title, strlen(title));
+        hash = bar_hash(hash, &is_live, sizeof(is_live));
+        hash = bar_hash(hash, state, sizeof(state));
+        if (bar_segment(bar, &bar->title, draw_x, w, hash)) {
+            int boxs = drw->fonts->h / 9;
+            int boxw = drw->fonts->h / 6 + 2;
+
+            if (is_live)
+                drw_setscheme(bar_drw, scheme[SchemeSelected]);
             else
-                drw_setscheme(drw, scheme[SchemeNormal]);
+                drw_setscheme(bar_drw, scheme[SchemeNormal]);
 
-            drw_text(drw,
+            drw_text(bar_drw,
                      draw_x, 0, (uint)w, bar_height,
-                     padding, monitor->selected_client->name, 0);
-            if (monitor->selected_client->is_floating) {
-                drw_rect(drw,
+                     padding, title, 0);
+            if (selected->is_floating) {
+                drw_rect(bar_drw,
                          draw_x + boxs, boxs, (uint)boxw, (uint)boxw,
-                         monitor->selected_client->is_fixed, 0);
+                         selected->is_fixed, 0);
             }
-        } else {
-            drw_setscheme(drw, scheme[SchemeNormal]);
-            drw_rect(drw, draw_x, 0, (uint)w, bar_height, true, true);
         }
+    } else if (bar_segment(bar, &bar->title, draw_x, w, BAR_HASH_SEED)) {
+        drw_setscheme(bar_drw, scheme[SchemeNormal]);
+        drw_rect(bar_drw, draw_x, 0, (uint)w, bar_height, true, true);
     }
-    drw_map(drw, monitor->top_bar_window,
-            0, 0, (uint)monitor->win_w, bar_height);
 
+    bar_end(bar, monitor->top_bar_window, width);
     return;
 }
 
 void
 monitor_layout_columns(Monitor *monitor) {
-    int number_tiled = 0;
-    int i = 0;
-    int x = 0;
-    int y = 0;
-    int mon_w;
+    int number_tiled = monitor_tag_buckets(monitor)->number_tiled;
 
-    for (Client *client_aux = client_next_tiled(monitor->clients);
-                 client_aux;
-                 client_aux = client_next_tiled(client_aux->next)) {
-        number_tiled += 1;
-    }
     if (number_tiled == 0)
         return;
-    if (number_tiled > 0) {
-        snprintf(monitor->layout_symbol, sizeof(monitor->layout_symbol),
-                 "|%d|", number_tiled);
-    }
-
-    if (number_tiled > monitor->number_masters) {
-        if (monitor->number_masters != 0)
-            mon_w = (int)((float)monitor->win_w*monitor->master_fact);
-        else
-            mon_w = 0;
-    } else {
-        mon_w = monitor->win_w;
-    }
-
-    for (Client *client = client_next_tiled(monitor->clients);
-                 client;
-                 client = client_next_tiled(client->next)) {
-        int w;
-        int h;
-        if (i < monitor->number_masters) {
-            w = (mon_w - x) / (MIN(number_tiled, monitor->number_masters) - i);
-            client_resize(client,
-                          x + monitor->win_x, monitor->win_y,
-                          w - (2*client->border_pixels),
-                          monitor->win_h - (2*client->border_pixels), false);
-            x += client_pixels_width(client);
-        } else {
-            h = (monitor->win_h - y) / (number_tiled - i);
-            client_resize(client,
-                          x + monitor->win_x, monitor->win_y + y,
-                          monitor->win_w - x - (2*client->border_pixels),
-                          h - (2*client->border_pixels), false);
-            y += client_pixels_height(client);
-        }
-        i += 1;
-    }
+    snprintf(monitor->layout_symbol, sizeof(monitor->layout_symbol),
+             "|%d|", number_tiled);
+    monitor_run_layout(monitor, layout_columns);
     return;
 }
 
 void
 monitor_layout_grid(Monitor *monitor) {
-    int number_tiled = 0;
-    int columns = 0;
-    int rows;
-    int col_i;
-    int row_i;
-    int column_width;
-    int i = 0;
+    int number_tiled = monitor_tag_buckets(monitor)->number_tiled;
 
-    for (Client *client = client_next_tiled(monitor->clients);
-                 client;
-                 client = client_next_tiled(client->next)) {
-        number_tiled += 1;
-    }
     if (number_tiled == 0)
         return;
-
-    if (number_tiled > 0) {
-        snprintf(monitor->layout_symbol, sizeof(monitor->layout_symbol),
-                 "#%d#", number_tiled);
-    }
-
-    /* grid dimensions */
-    while (columns*columns < number_tiled) {
-        if (columns > (number_tiled / 2))
-            break;
-        columns += 1;
-    }
-
-    if (number_tiled == 5) {
-        /* set layout against the general calculation: not 1:2:2, but 2:3 */
-        columns = 2;
-    }
-    rows = number_tiled/columns;
-
-    if (columns == 0)
-        column_width = monitor->win_w;
-    else
-        column_width = monitor->win_w / columns;
-
-    col_i = 0;
-    row_i = 0;
-    for (Client *client = client_next_tiled(monitor->clients);
-                 client;
-                 client = client_next_tiled(client->next)) {
-        int client_height;
-        int new_x;
-        int new_y;
-        int new_w;
-        int new_h;
-
-        if ((i/rows + 1) > (columns - number_tiled % columns))
-            rows = number_tiled/columns + 1;
-
-        client_height = monitor->win_h / rows;
-
-        new_x = monitor->win_x + col_i*column_width;
-        new_y = monitor->win_y + row_i*client_height;
-        new_w = column_width - 2*client->border_pixels;
-        new_h = client_height - 2*client->border_pixels;
-        client_resize(client, new_x, new_y, new_w, new_h, false);
-
-        row_i += 1;
-        if (row_i >= rows) {
-            row_i = 0;
-            col_i += 1;
-        }
-        i += 1;
-    }
+    snprintf(monitor->layout_symbol, sizeof(monitor->layout_symbol),
+             "#%d#", number_tiled);
+    monitor_run_layout(monitor, layout_grid);
     return;
 }
 
 void
 monitor_layout_monocle(Monitor *monitor) {
-    uint number_clients = 0;
-
-    for (Client *client = monitor->clients; client; client = client->next) {
-        if (client_is_visible(client))
-            number_clients += 1;
-    }
+    int number_clients = monitor_tag_buckets(monitor)->number_visible;
 
     if (number_clients > 0) {
         snprintf(monitor->layout_symbol, sizeof(monitor->layout_symbol),
                  "[%d]", number_clients);
     }
-
-    for (Client *client = client_next_tiled(monitor->clients);
-                 client;
-                 client = client_next_tiled(client->next)) {
-        int new_x = monitor->win_x;
-        int new_y = monitor->win_y;
-        int new_w = monitor->win_w - 2*client->border_pixels;
-        int new_h = monitor->win_h - 2*client->border_pixels;
-        client_resize(client, new_x, new_y, new_w, new_h, false);
-    }
+    monitor_run_layout(monitor, layout_monocle);
     return;
 }
 
 void
 monitor_layout_tile(Monitor *monitor) {
-    int number_tiled = 0;
-    int i = 0;
-    int mon_w = 0;
-    int mon_y = 0;
-    int tile_y = 0;
+    int number_tiled = monitor_tag_buckets(monitor)->number_tiled;
 
-    for (Client *client_aux = client_next_tiled(monitor->clients);
-                 client_aux;
-                 client_aux = client_next_tiled(client_aux->next)) {
-        number_tiled += 1;
-    }
     if (number_tiled == 0)
         return;
-    if (number_tiled > 0) {
-        snprintf(monitor->layout_symbol, sizeof(monitor->layout_symbol),
-                 "=%d|", number_tiled);
+    snprintf(monitor->layout_symbol, sizeof(monitor->layout_symbol),
+             "=%d|", number_tiled);
+    monitor_run_layout(monitor, layout_tile);
+    return;
+}
+
+/* Layouts themselves live in layout.c and know nothing about X: this
+ * copies what they need out of the tiled clients, runs one and commits
+ * the resulting plan. The arrays only ever grow. */
+void
+monitor_run_layout(Monitor *monitor, LayoutFunction *function) {
+    static Client **tiled;
+    static LayoutClient *inputs;
+    static LayoutRect *plan;
+    static int capacity;
+    TagBuckets *buckets = monitor_tag_buckets(monitor);
+    LayoutArea area;
+    int n = 0;
+
+    if (buckets->number_tiled > capacity) {
+        capacity = MAX(2*capacity, buckets->number_tiled);
+        free(tiled);
+        free(inputs);
+        free(plan);
+        tiled = xcalloc((size_t)capacity, sizeof(*tiled));
+        inputs = xcalloc((size_t)capacity, sizeof(*inputs));
+        plan = xcalloc((size_t)capacity, sizeof(*plan));
+    }
+
+    for (int i = 0; i < buckets->number_visible && n < capacity; i += 1) {
+        Client *client = buckets->visible[i];
+        LayoutClient *input = &inputs[n];
+
+        if (client->is_floating)
+            continue;
+        if (resizehints && !client->hintsvalid)
+            client_update_size_hints(client);
+
+        /* hints without effect are left in the cold part */
+        input->apply_hints = resizehints && client->has_hints;
+        if (input->apply_hints)
+            input->hints = client_cold(client)->hints;
+        input->w = client->w;
+        input->h = client->h;
+        input->border = client->border_pixels;
+        tiled[n] = client;
+        n += 1;
     }
 
-    if (number_tiled > monitor->number_masters) {
-        if (monitor->number_masters != 0)
-            mon_w = (int)((float)monitor->win_w*monitor->master_fact);
-        else
-            mon_w = 0;
-    } else {
-        mon_w = monitor->win_w;
+    area.x = monitor->win_x;
+    area.y = monitor->win_y;
+    area.w = monitor->win_w;
+    area.h = monitor->win_h;
+    area.number_masters = monitor->number_masters;
+    area.master_fact = monitor->master_fact;
+    area.min_size = (int)bar_height;
+
+    function(&area, inputs, n, plan);
+
+    for (int i = 0; i < n; i += 1)
+        client_resize_commit(tiled[i], plan[i].x, plan[i].y,
+                                       plan[i].w, plan[i].h);
+    return;
+}
+
+TagBuckets *
+monitor_tag_buckets(Monitor *monitor) {
+    TagBuckets *buckets = monitor->buckets;
+    uint tagset = monitor->tagset[monitor->selected_tags];
+    int n = 0;
+
+    if (buckets->valid && buckets->tagset == tagset)
+        return buckets;
+
+    for (Client *client = monitor->clients; client; client = client->next)
+        n += 1;
+    if (n > buckets->capacity) {
+        buckets->capacity = MAX(2*buckets->capacity, n);
+        free(buckets->visible);
+        buckets->visible = xcalloc((size_t)buckets->capacity,
+                                   sizeof(*buckets->visible));
     }
 
-    for (Client *client = client_next_tiled(monitor->clients);
-                 client;
-                 client = client_next_tiled(client->next)) {
-        int h;
-        int borders = 2*client->border_pixels;
-        int min_number = MIN(number_tiled, monitor->number_masters);
+    buckets->number_visible = 0;
+    buckets->number_tiled = 0;
+    buckets->urgent = 0;
+    memset(buckets->icon_owners, 0, sizeof(buckets->icon_owners));
+    memset(buckets->masters_names, 0, sizeof(buckets->masters_names));
 
-        if (i < monitor->number_masters) {
-            h = (monitor->win_h - mon_y) / (min_number - i);
-            client_resize(client,
-                          monitor->win_x, monitor->win_y + mon_y,
-                          mon_w - borders, h - borders,
-                          false);
-            if (mon_y + client_pixels_height(client) < monitor->win_h)
-                mon_y += client_pixels_height(client);
-        } else {
-            h = (monitor->win_h - tile_y) / (number_tiled - i);
-            client_resize(client,
-                          monitor->win_x + mon_w, monitor->win_y + tile_y,
-                          monitor->win_w - mon_w - borders, h - borders,
-                          false);
-            if (tile_y + client_pixels_height(client) < monitor->win_h)
-                tile_y += client_pixels_height(client);
+    for (Client *client = monitor->clients; client; client = client->next) {
+        ClientCold *cold = client_cold(client);
+
+        if (client->tags & tagset) {
+            buckets->visible[buckets->number_visible] = client;
+            buckets->number_visible += 1;
+            buckets->number_tiled += !client->is_floating;
+        }
+        if (client->is_urgent)
+            buckets->urgent |= client->tags;
+
+        for (int i = 0; i < LENGTH(tags); i += 1) {
+            if (!(client->tags & (1 << i)))
+                continue;
+            if (cold->icon)
+                buckets->icon_owners[i] = client;
+            if (!buckets->masters_names[i] && cold->class[0])
+                buckets->masters_names[i] = cold->class;
         }
-        i += 1;
     }
-    return;
+
+    buckets->tagset = tagset;
+    buckets->valid = true;
+    return buckets;
 }
 
 void
-monitor_restack(Monitor *m) {
-    XEvent event;
+monitor_restack(Monitor *monitor) {
+    monitor_set_dirty(monitor, DirtyRestack);
+    return;
+}
 
-    monitor_draw_bars(m);
+void
+monitor_apply_stack(Monitor *m) {
+    STATS_COUNT(StatsRestack);
     if (!m->selected_client)
         return;
 
@@ -2591,8 +4375,6 @@ monitor_restack(Monitor *m) {
             }
         }
     }
-    XSync(display, False);
-    while (XCheckMaskEvent(display, EnterWindowMask, &event));
     return;
 }
 
@@ -2619,40 +4401,136 @@ monitor_update_bar_position(Monitor *monitor) {
     return;
 }
 
+/* Only clients whose visibility flipped since the last pass are moved:
+ * client->is_shown remembers where each window was left, place_again
+ * forgets it. Shown ones go top down and hidden ones bottom up, so that
+ * nothing below gets exposed. */
 void
-monitor_arrange(Monitor *monitor) {
-    if (monitor) {
-        client_show_hide(monitor->stack);
-    } else {
-        for (monitor = monitors; monitor; monitor = monitor->next)
-            client_show_hide(monitor->stack);
-    }
-    if (monitor) {
-        monitor_arrange_monitor(monitor);
-        monitor_restack(monitor);
-    } else {
-        XEvent event;
-        for (Monitor *monitor_aux = monitors;
-                      monitor_aux;
-                      monitor_aux = monitor_aux->next) {
-            monitor_arrange_monitor(monitor_aux);
-        }
-        XSync(display, False);
-        while (XCheckMaskEvent(display, EnterWindowMask, &event));
-    }
-    return;
-}
+monitor_show_hide(Monitor *monitor) {
+    static Client **hiding;
+    static int capacity;
+    int number_hiding = 0;
+    bool monitor_floating = !monitor->layout[monitor->lay_i]->function;
+    bool layout_changed = monitor_floating != monitor->shown_floating;
 
-Monitor *
+    monitor->shown_floating = monitor_floating;
+
+    for (Client *client = monitor->stack;
+                 client;
+                 client = client->stack_next) {
+        bool forced = client->place_again;
+
+        client->place_again = false;
+        if (!client_is_visible(client)) {
+            if (!client->is_shown && !forced)
+                continue;
+            if (number_hiding >= capacity) {
+                Client **grown;
+                capacity = MAX(2*capacity, 64);
+                grown = xcalloc((size_t)capacity, sizeof(*grown));
+                if (number_hiding)
+                    memcpy(grown, hiding, (size_t)number_hiding*sizeof(*grown));
+                free(hiding);
+                hiding = grown;
+            }
+            hiding[number_hiding] = client;
+            number_hiding += 1;
+            continue;
+        }
+        if (client->is_shown && !forced && !layout_changed)
+            continue;
+
+        if (!client->is_shown || forced) {
+            if ((client->tags) && client->is_floating)
+                client_center(client);
+            XMoveWindow(display, client->window, client->x, client->y);
+            client->is_shown = true;
+        }
+
+        if ((monitor_floating || client->is_floating)
+            && (!client->is_fullscreen || client->is_fake_fullscreen)) {
+            client_resize(client,
+                          client->x, client->y, client->w, client->h,
+                          false);
+        }
+    }
+
+    while (number_hiding > 0) {
+        Client *client = hiding[--number_hiding];
+        XMoveWindow(display, client->window,
+                    -2*client_pixels_width(client), client->y);
+        client->is_shown = false;
+    }
+    return;
+}
+
+void
+monitor_arrange(Monitor *monitor) {
+    monitor_set_dirty(monitor, DirtyArrange);
+    return;
+}
+
+/* Handlers only record what has to be redone, NULL meaning every monitor.
+ * The work itself happens once per drained event queue, in
+ * flush_dirty_monitors(). */
+void
+monitor_set_dirty(Monitor *monitor, uint dirty) {
+    if (monitor) {
+        monitor->dirty |= dirty;
+    } else {
+        for (monitor = monitors; monitor; monitor = monitor->next)
+            monitor->dirty |= dirty;
+    }
+    return;
+}
+
+void
+flush_dirty_monitors(void) {
+    bool restacked = false;
+
+    STATS_COUNT(StatsFlush);
+
+    for (Monitor *monitor = monitors; monitor; monitor = monitor->next) {
+        if (monitor->dirty & DirtyArrange)
+            monitor_show_hide(monitor);
+    }
+    for (Monitor *monitor = monitors; monitor; monitor = monitor->next) {
+        if (monitor->dirty & DirtyArrange)
+            monitor_arrange_monitor(monitor);
+    }
+    for (Monitor *monitor = monitors; monitor; monitor = monitor->next) {
+        if (monitor->dirty & (DirtyArrange|DirtyRestack)) {
+            monitor_apply_stack(monitor);
+            restacked = true;
+        }
+        if (monitor->dirty)
+            monitor_draw_bars(monitor);
+        monitor->dirty = 0;
+    }
+
+    client_list_publish(restacked);
+
+    if (restacked) {
+        XEvent event;
+        XSync(display, False);
+        while (XCheckMaskEvent(display, EnterWindowMask, &event));
+    }
+    return;
+}
+
+Monitor *
 create_monitor(void) {
     Monitor *monitor = xcalloc(1, sizeof(*monitor));
     Pertag *pertag = xcalloc(1, sizeof(*pertag));
 
+    monitor->bars = xcalloc(2, sizeof(*monitor->bars));
+
     monitor->tagset[0] = monitor->tagset[1] = 1;
     monitor->master_fact = master_fact;
     monitor->number_masters = 1;
     monitor->show_top_bar = true;
     monitor->show_bottom_bar = true;
+    monitor->frame_milis = DRAG_FRAME_MILIS;
 
     monitor->layout[0] = &layouts[0];
     monitor->layout[1] = &layouts[1 % LENGTH(layouts)];
@@ -2674,6 +4552,7 @@ create_monitor(void) {
         pertag->bottom_bars[i] = monitor->show_bottom_bar;
     }
     monitor->pertag = pertag;
+    monitor->buckets = xcalloc(1, sizeof(*monitor->buckets));
 
     return monitor;
 }
@@ -2693,52 +4572,51 @@ get_root_pointer(int *x, int *y) {
     return XQueryPointer(display, root, &dummy, &dummy, x, y, &di, &di, &dui);
 }
 
-long
-window_state(Window window) {
-    int actual_format_return;
-    long result = -1;
-    uchar *prop_return = NULL;
-    ulong nitems_return;
-    ulong bytes_after_return;
-    Atom actual_type_return;
-    int success;
 
-    success = XGetWindowProperty(display, window, wm_atoms[WM_STATE],
-                                0L, 2L, False, wm_atoms[WM_STATE],
-                                &actual_type_return, &actual_format_return,
-                                &nitems_return, &bytes_after_return,
-                                (uchar **)&prop_return);
-    if (success != Success)
-        return -1;
+int
+window_text_property(Window window, Atom atom, char *text, uint size) {
+    xcb_get_property_cookie_t cookie;
 
-    if (nitems_return != 0)
-        result = *prop_return;
-    XFree(prop_return);
-    return result;
+    cookie = window_property_request(window, atom, AnyPropertyType, size);
+    return window_read_text(window_property_reply(cookie), text, size);
 }
 
+/* Like XGetTextProperty() plus the conversion to the locale encoding.
+ * Returns 0 when the property is not set. */
 int
-window_text_property(Window window, Atom atom, char *text, uint size) {
+window_read_text(xcb_get_property_reply_t *reply, char *text, uint size) {
     XTextProperty text_property;
     char **list_return = NULL;
+    char *value;
     int count_return;
+    int length;
     int success;
 
-    if (!text || size == 0)
+    if (!text || size == 0) {
+        free(reply);
         return 0;
+    }
     text[0] = '\0';
-
-    success = XGetTextProperty(display, window, &text_property, atom);
-    if (!success || !text_property.nitems)
+    if (!reply)
         return 0;
 
-    if (text_property.encoding == XA_STRING) {
-        strncpy(text, (char *)text_property.value, size - 1);
-        text[size - 1] = '\0';
-        XFree(text_property.value);
+    length = xcb_get_property_value_length(reply);
+    if (reply->type == XA_STRING) {
+        int n = MIN(length, (int)size - 1);
+        memcpy(text, xcb_get_property_value(reply), (size_t)n);
+        text[n] = '\0';
+        free(reply);
         return 1;
     }
 
+    /* Xlib expects the value to be null terminated */
+    value = xcalloc(1, (size_t)length + 1);
+    memcpy(value, xcb_get_property_value(reply), (size_t)length);
+    text_property.value = (uchar *)value;
+    text_property.encoding = reply->type;
+    text_property.format = reply->format;
+    text_property.nitems = reply->value_len;
+
     success = XmbTextPropertyToTextList(display, &text_property,
                                        &list_return, &count_return);
     if (success >= Success && count_return > 0 && *list_return) {
@@ -2747,19 +4625,63 @@ window_text_property(Window window, Atom atom, char *text, uint size) {
     }
 
     text[size - 1] = '\0';
-    XFree(text_property.value);
+    free(value);
+    free(reply);
     return 1;
 }
 
+/* length is in 32 bit units, as for XGetWindowProperty() */
+xcb_get_property_cookie_t
+window_property_request(Window window, Atom property, Atom type,
+                        uint32 length) {
+    return xcb_get_property(xcb_connection, 0,
+                            (xcb_window_t)window, (xcb_atom_t)property,
+                            (xcb_atom_t)type, 0, length);
+}
+
+/* Collects a reply asked for with window_property_request(). Returns NULL
+ * when the window is gone or the property is unset or has another type.
+ * Otherwise the reply must be freed, which the *_read_*() functions
+ * taking one do themselves, NULL included. */
+xcb_get_property_reply_t *
+window_property_reply(xcb_get_property_cookie_t cookie) {
+    xcb_generic_error_t *error_return = NULL;
+    xcb_get_property_reply_t *reply;
+
+    reply = xcb_get_property_reply(xcb_connection, cookie, &error_return);
+    STATS_COUNT(StatsXcbReply);
+    free(error_return);
+    if (reply && xcb_get_property_value_length(reply) <= 0) {
+        free(reply);
+        return NULL;
+    }
+    return reply;
+}
+
+Atom
+window_read_atom(xcb_get_property_reply_t *reply) {
+    Atom atom = None;
+
+    if (reply) {
+        if (reply->format == 32)
+            atom = *(uint32 *)xcb_get_property_value(reply);
+        free(reply);
+    }
+    return atom;
+}
+
 void
 grab_keys(void) {
     uint modifiers[] = { 0, LockMask, numlock_mask, numlock_mask|LockMask };
     int first_keycode;
     int end;
     int keysyms_per_keycode_return;
+    int number_bindings = 0;
     KeySym *key_sym;
 
     update_numlock_mask();
+    for (int i = 0; i < LENGTH(keys); i += 1)
+        key_table.masks[i] = CLEANMASK((uint)keys[i].mod);
 
     XUngrabKey(display, AnyKey, AnyModifier, root);
     XDisplayKeycodes(display, &first_keycode, &end);
@@ -2771,11 +4693,30 @@ grab_keys(void) {
     if (!key_sym)
         return;
 
+    /* counted first, so that the bindings are one array */
     for (int k = first_keycode; k <= end; k += 1) {
+        int index = keysyms_per_keycode_return*(k - first_keycode);
+        for (int i = 0; i < LENGTH(keys); i += 1) {
+            if (keys[i].keysym == key_sym[index])
+                number_bindings += 1;
+        }
+    }
+    free(key_table.bindings);
+    key_table.bindings = xcalloc((size_t)MAX(number_bindings, 1),
+                                 sizeof(*key_table.bindings));
+    number_bindings = 0;
+
+    for (int k = 0; k <= 256; k += 1) {
+        key_table.start[k] = number_bindings;
+        if (k < first_keycode || k > end)
+            continue;
+
         for (int i = 0; i < LENGTH(keys); i += 1) {
             /* skip modifier codes, we do that ourselves */
             int index = keysyms_per_keycode_return*(k - first_keycode);
             if (keys[i].keysym == key_sym[index]) {
+                key_table.bindings[number_bindings] = i;
+                number_bindings += 1;
                 for (int j = 0; j < LENGTH(modifiers); j += 1)
                     XGrabKey(display, k, (uint)keys[i].mod | modifiers[j],
                              root, True, GrabModeAsync, GrabModeAsync);
@@ -2866,27 +4807,31 @@ handler_button_press(XEvent *event) {
 
     monitor = live_monitor;
     if (button_event->window == monitor->top_bar_window) {
+        Bar *bar = &monitor->bars[BarTop];
+        BarSegment *layout_symbol = &bar->layout_symbol;
+        int status_x = monitor->win_w - status_top.pixels;
         uint i = 0;
-        int x = 0;
 
-        do {
-            x += tags_widths[i];
-        } while (button_x >= x && ++i < LENGTH(tags));
+        while (i < LENGTH(tags)
+               && button_x >= bar->tags[i].x + bar->tags[i].w) {
+            i += 1;
+        }
 
         if (i < LENGTH(tags)) {
             click = ClickBarTags;
             arg.ui = 1 << i;
-        } else if (button_x < x + get_text_pixels(monitor->layout_symbol)) {
+        } else if (button_x < layout_symbol->x + layout_symbol->w) {
             click = ClickBarLayoutSymbol;
-        } else if (button_x > monitor->win_w - status_top.pixels) {
+        } else if (button_x > status_x) {
             click = ClickBarStatus;
-            status_get_signal_number(status_top.blocks_signal, button_x);
+            status_get_signal_number(&status_top, button_x - status_x);
         } else {
             click = ClickBarTitle;
         }
     } else if (button_event->window == monitor->bottom_bar_window) {
+        int status_x = (monitor->win_w - status_bottom.pixels)/2;
         click = ClickBottomBar;
-        status_get_signal_number(status_bottom.blocks_signal, button_x);
+        status_get_signal_number(&status_bottom, button_x - status_x);
     } else if ((client = window_to_client(button_event->window))) {
         client_focus(client);
         monitor_restack(monitor);
@@ -2904,60 +4849,97 @@ handler_button_press(XEvent *event) {
 
         if (buttons[i].function) {
             if (click == ClickBarTags && buttons[i].arg.i == 0)
-                buttons[i].function(&arg);
+                run_action(buttons[i].function, &arg);
             else
-                buttons[i].function(&buttons[i].arg);
+                run_action(buttons[i].function, &buttons[i].arg);
         }
     }
     return;
 }
 
-void draw_status_text(StatusBar *status_bar, int monitor_width) {
-    int pixels = 0;
-    int x0;
-    if (status_bar == &status_top)
-        x0 = monitor_width - status_bar->pixels;
-    else
-        x0 = (monitor_width - status_bar->pixels)/2;
+/* block positions stay relative to the start of the status,
+ * x0 is where that start lands on this bar */
+void
+draw_status_text(Bar *bar, StatusBar *status_bar, int x0) {
+    DrwText runs[STATUS_MAX_BLOCKS];
+    size_t number_runs = 0;
 
     for (int i = 0; i < status_bar->number_blocks; i += 1) {
         BlockSignal *block = &status_bar->blocks_signal[i];
+        char *text = &status_bar->text[block->text_i];
         int text_pixels = block->max_x - block->min_x;
-
-        block->max_x += x0;
-        block->min_x += x0;
-
-        if (text_pixels) {
-            drw_text(drw,
-                     x0 + pixels, 0, (uint)text_pixels, bar_height,
-                     0, &(status_bar->text[block->text_i]), 0);
-            pixels += text_pixels;
+        int x = x0 + block->min_x;
+
+        if (bar_segment(bar, &bar->status[i], x, text_pixels, block->hash)) {
+            runs[number_runs] = (DrwText){
+                .x = x, .y = 0,
+                .w = (uint)text_pixels, .h = bar_height,
+                .lpad = 0,
+                .text = text,
+                .scheme = scheme[block->scheme],
+                .invert = 0,
+            };
+            number_runs += 1;
         }
     }
+    drw_texts(bar->drw, runs, number_runs);
+    for (int i = status_bar->number_blocks; i < STATUS_MAX_BLOCKS; i += 1)
+        bar->status[i] = (BarSegment){0};
     return;
 }
 
+/* Re-measures block i only if its text or colors differ from the ones it
+ * had in the previous update, dirty tells draw_status_text to draw it. */
 void
-status_parse_text(StatusBar *status_bar) {
+status_measure_block(StatusBar *status_bar, int i, char *text, int color) {
+    BlockSignal *block = &status_bar->blocks_signal[i];
+    uint64 hash = bar_hash(BAR_HASH_SEED, text, strlen(text));
+
+    hash = bar_hash(hash, &color, sizeof(color)) | 1;
+    block->dirty = i >= status_bar->number_blocks || block->hash != hash;
+    if (block->dirty) {
+        block->hash = hash;
+        block->text_pixels = get_text_pixels(text) - text_padding;
+    }
+    block->text_i = (int) (text - status_bar->text);
+    block->scheme = color;
+    return;
+}
+
+/* Splits raw into blocks at control characters, which carry the signal
+ * of the following block. Returns whether anything visible changed. */
+bool
+status_parse_text(StatusBar *status_bar, const char *raw) {
     BlockSignal *blocks = status_bar->blocks_signal;
+    size_t length = strnlen(raw, sizeof(status_bar->text) - 1);
+    uint64 hash = bar_hash(BAR_HASH_SEED, raw, length) | 1;
     int i = 0;
     char *text = status_bar->text;
     char *status = status_bar->text;
     int total_pixels = 0;
     int text_pixels;
-    char byte = *status;
+    char byte;
+    bool changed = false;
 
-    while (*status) {
+    if (hash == status_bar->hash)
+        return false;
+    status_bar->hash = hash;
+    memcpy(status_bar->text, raw, length);
+    status_bar->text[length] = '\0';
+    byte = *status;
+
+    while (*status && i < STATUS_MAX_BLOCKS - 1) {
         if ((uchar)(*status) < ' ') {
             blocks[i].signal = byte;
             byte = *status;
             *status = '\0';
 
-            text_pixels = get_text_pixels(text) - text_padding;
+            status_measure_block(status_bar, i, text, SchemeNormal);
+            changed = changed || blocks[i].dirty;
+            text_pixels = blocks[i].text_pixels;
 
             blocks[i].min_x = total_pixels;
             blocks[i].max_x = blocks[i].min_x + text_pixels;
-            blocks[i].text_i = (int) (text - status_bar->text);
 
             total_pixels += text_pixels;
             i += 1;
@@ -2968,24 +4950,28 @@ status_parse_text(StatusBar *status_bar) {
     }{
         blocks[i].signal = byte;
 
-        text_pixels = get_text_pixels(text) - text_padding + 2;
+        status_measure_block(status_bar, i, text, SchemeNormal);
+        changed = changed || blocks[i].dirty;
+        text_pixels = blocks[i].text_pixels + 2;
 
         blocks[i].min_x = total_pixels;
         blocks[i].max_x = blocks[i].min_x + text_pixels;
-        blocks[i].text_i = (int) (text - status_bar->text);
 
         total_pixels += text_pixels;
     }
+    /* a block more or less moves the edges of the others */
+    changed = changed || status_bar->number_blocks != i + 1;
     status_bar->number_blocks = i + 1;
     status_bar->pixels = total_pixels;
-    return;
+    return changed;
 }
 
 void
-status_get_signal_number(BlockSignal *blocks, int button_x) {
+status_get_signal_number(StatusBar *status_bar, int button_x) {
+    BlockSignal *blocks = status_bar->blocks_signal;
     status_signal = 0;
 
-    for (int i = 0; i < STATUS_MAX_BLOCKS; i += 1) {
+    for (int i = 0; i < status_bar->number_blocks; i += 1) {
         if (blocks[i].min_x <= button_x && button_x <= blocks[i].max_x) {
             status_signal = blocks[i].signal;
             break;
@@ -3041,24 +5027,25 @@ handler_configure_request(XEvent *event) {
 
         if (client->is_floating || mon_floating) {
             Monitor *monitor;
+            ClientCold *cold = client_cold(client);
             bool mask_xy;
             bool mask_hw;
 
             monitor = client->monitor;
             if (conf_request_event->value_mask & CWX) {
-                client->old_x = client->x;
+                cold->old_x = client->x;
                 client->x = monitor->mon_x + conf_request_event->x;
             }
             if (conf_request_event->value_mask & CWY) {
-                client->old_y = client->y;
+                cold->old_y = client->y;
                 client->y = monitor->mon_y + conf_request_event->y;
             }
             if (conf_request_event->value_mask & CWWidth) {
-                client->old_w = client->w;
+                cold->old_w = client->w;
                 client->w = conf_request_event->width;
             }
             if (conf_request_event->value_mask & CWHeight) {
-                client->old_h = client->h;
+                cold->old_h = client->h;
                 client->h = conf_request_event->height;
             }
 
@@ -3106,40 +5093,43 @@ handler_configure_request(XEvent *event) {
 void
 handler_configure_notify(XEvent *event) {
     XConfigureEvent *configure_event = &event->xconfigure;
-    int dirty;
+    bool resized;
 
     if (configure_event->window != root)
         return;
 
-    /* TODO: update_geometry handling sucks, needs to be simplified */
-    dirty = screen_width != configure_event->width
-            || screen_height != configure_event->height;
+    resized = screen_width != configure_event->width
+              || screen_height != configure_event->height;
     screen_width = configure_event->width;
     screen_height = configure_event->height;
 
-    if (update_geometry() || dirty) {
-        drw_resize(drw, (uint)screen_width, bar_height);
-        configure_bars_windows();
-        for (Monitor *mon = monitors; mon; mon = mon->next) {
-            for (Client *client = mon->clients; client; client = client->next) {
-                if (client->is_fullscreen && !client->is_fake_fullscreen) {
-                    client_resize_apply(client,
-                                        mon->mon_x, mon->mon_y,
-                                        mon->mon_w, mon->mon_h);
-                }
-            }
-            XMoveResizeWindow(display, mon->top_bar_window,
-                              mon->win_x, mon->top_bar_y,
-                              (uint)mon->win_w, bar_height);
-            XMoveResizeWindow(display, mon->bottom_bar_window,
-                              mon->win_x, mon->bottom_bar_y,
-                              (uint)mon->win_w, bar_height);
-        }
-        client_focus(NULL);
-        monitor_arrange(NULL);
+#ifdef XRANDR
+    /* outputs are followed by their own events, see handler_randr_notify */
+    if (randr_event_base >= 0) {
+        if (resized)
+            monitor_set_dirty(NULL, DirtyArrange);
+        return;
     }
+#endif /* XRANDR */
+    update_geometry_apply(resized);
+    return;
+}
+
+#ifdef XRANDR
+/* Docking, undocking and DPMS wakeups send several of these in a row:
+ * the outputs are only read again once GEOMETRY_SETTLE_MILIS passed
+ * without another one, by event_loop(). */
+void
+handler_randr_notify(XEvent *event) {
+    XRRUpdateConfiguration(event);
+    clock_gettime(CLOCK_MONOTONIC, &geometry_deadline);
+    geometry_deadline.tv_nsec += PAUSE_MILIS_AS_NANOS(GEOMETRY_SETTLE_MILIS);
+    geometry_deadline.tv_sec += geometry_deadline.tv_nsec / 1000000000;
+    geometry_deadline.tv_nsec %= 1000000000;
+    geometry_pending = true;
     return;
 }
+#endif /* XRANDR */
 
 void
 handler_destroy_notify(XEvent *event) {
@@ -3193,30 +5183,42 @@ handler_focus_in(XEvent *event) {
     return;
 }
 
+/* bar pixmaps persist, so exposed areas are just copied back */
 void
 handler_expose(XEvent *event) {
     Monitor *monitor;
+    Bar *bar;
     XExposeEvent *expose_event = &event->xexpose;
+    Window window = expose_event->window;
 
-    if (expose_event->count != 0)
+    if (!(monitor = window_table_lookup(&bar_windows, window)))
         return;
-    if ((monitor = window_to_monitor(expose_event->window)))
-        monitor_draw_bars(monitor);
+
+    if (window == monitor->top_bar_window)
+        bar = &monitor->bars[BarTop];
+    else
+        bar = &monitor->bars[BarBottom];
+
+    drw_map(bar->drw, window,
+            expose_event->x, expose_event->y,
+            (uint)expose_event->width, (uint)expose_event->height);
     return;
 }
 
 void
 handler_key_press(XEvent *event) {
-    KeySym keysym;
     XKeyEvent *key_event = &event->xkey;
-    keysym = XKeycodeToKeysym(display, (KeyCode)key_event->keycode, 0);
+    KeyCode keycode = (KeyCode)key_event->keycode;
+    uint state = CLEANMASK(key_event->state);
 
-    for (uint i = 0; i < LENGTH(keys); i += 1) {
-        if (keysym == keys[i].keysym
-            && CLEANMASK(keys[i].mod) == CLEANMASK(key_event->state)
-            && keys[i].function) {
-            keys[i].function(&(keys[i].arg));
-        }
+    if (!key_table.bindings)
+        return;
+    for (int b = key_table.start[keycode]; b < key_table.start[keycode + 1];
+         b += 1) {
+        const Key *key = &keys[key_table.bindings[b]];
+
+        if (key_table.masks[key_table.bindings[b]] == state && key->function)
+            run_action(key->function, &(key->arg));
     }
     return;
 }
@@ -3226,8 +5228,11 @@ handler_mapping_notify(XEvent *event) {
     XMappingEvent *mapping_event = &event->xmapping;
 
     XRefreshKeyboardMapping(mapping_event);
-    if (mapping_event->request == MappingKeyboard)
+    /* either may change what a keycode binds or the numlock mask */
+    if (mapping_event->request == MappingKeyboard
+        || mapping_event->request == MappingModifier) {
         grab_keys();
+    }
     return;
 }
 
@@ -3276,8 +5281,13 @@ handler_property_notify(XEvent *event) {
 
     if ((property_event->window == root)
         && (property_event->atom == XA_WM_NAME)) {
-        status_update();
-        monitor_draw_bars(live_monitor);
+        if (status_update())
+            monitor_set_dirty(live_monitor, DirtyBars);
+        return;
+    }
+    if ((property_event->window == root)
+        && (property_event->atom == status_pid_atom)) {
+        status_forget_pid();
         return;
     }
     if (property_event->state == PropertyDelete)
@@ -3292,6 +5302,7 @@ handler_property_notify(XEvent *event) {
             if (XGetTransientForHint(display, client->window, &trans)) {
                 if (window_to_client(trans)) {
                     client->is_floating = true;
+                    client_tags_changed(client);
                     monitor_arrange(client->monitor);
                 }
             }
@@ -3304,6 +5315,10 @@ handler_property_notify(XEvent *event) {
         client_update_wm_hints(client);
         draw_bars();
         break;
+    case XA_WM_CLASS:
+        client_update_class(client);
+        monitor_set_dirty(client->monitor, DirtyBars);
+        break;
     default:
         break;
     }
@@ -3312,11 +5327,11 @@ handler_property_notify(XEvent *event) {
         || property_event->atom == net_atoms[NET_WM_NAME]) {
         client_update_title(client);
         if (client == client->monitor->selected_client)
-            monitor_draw_bars(client->monitor);
+            monitor_set_dirty(client->monitor, DirtyBars);
     } else if (property_event->atom == net_atoms[NET_WM_ICON]) {
         client_update_icon(client);
         if (client == client->monitor->selected_client)
-            monitor_draw_bars(client->monitor);
+            monitor_set_dirty(client->monitor, DirtyBars);
     }
     if (property_event->atom == net_atoms[NET_WM_WINDOW_TYPE])
         client_update_window_type(client);
@@ -3478,6 +5493,15 @@ rectangle_to_monitor(int x, int y, int w, int h) {
     return monitor;
 }
 
+Monitor *
+num_to_monitor(int num) {
+    Monitor *monitor;
+
+    for (monitor = monitors; monitor && monitor->num != num;
+         monitor = monitor->next);
+    return monitor;
+}
+
 Monitor *
 direction_to_monitor(int direction) {
     Monitor *monitor = NULL;
@@ -3497,101 +5521,125 @@ direction_to_monitor(int direction) {
     return monitor;
 }
 
-Client *
-window_to_client(Window window) {
-    for (Monitor *mon = monitors; mon; mon = mon->next) {
-        for (Client *client = mon->clients; client; client = client->next) {
-            if (client->window == window)
-                return client;
-        }
+static uint
+window_hash(Window window) {
+    /* XIDs of one X client only differ in the low bits, mix them */
+    uint64 hash = (uint64)window*0x9E3779B97F4A7C15u;
+    return (uint)(hash >> 32);
+}
+
+void *
+window_table_lookup(WindowTable *table, Window window) {
+    uint mask = table->capacity - 1;
+
+    if (table->count == 0)
+        return NULL;
+
+    for (uint i = window_hash(window) & mask;
+              table->entries[i].window != None;
+              i = (i + 1) & mask) {
+        if (table->entries[i].window == window)
+            return table->entries[i].pointer;
     }
     return NULL;
 }
 
-Monitor *
-window_to_monitor(Window window) {
-    Client *client;
+void
+window_table_insert(WindowTable *table, Window window, void *pointer) {
+    uint mask;
+    uint i;
 
-    if (window == root) {
-        int x;
-        int y;
-        if (get_root_pointer(&x, &y)) {
-            Monitor *monitor = rectangle_to_monitor(x, y, 1, 1);
-            return monitor;
+    if (2*(table->count + 1) > table->capacity) {
+        WindowEntry *old_entries = table->entries;
+        uint old_capacity = table->capacity;
+
+        table->capacity = MAX(64, 2*old_capacity);
+        table->entries = xcalloc(table->capacity, sizeof(*table->entries));
+        table->count = 0;
+
+        for (uint j = 0; j < old_capacity; j += 1) {
+            if (old_entries[j].window != None) {
+                window_table_insert(table,
+                                    old_entries[j].window,
+                                    old_entries[j].pointer);
+            }
         }
+        free(old_entries);
     }
-    for (Monitor *monitor = monitors; monitor; monitor = monitor->next) {
-        if (window == monitor->top_bar_window
-            || window == monitor->bottom_bar_window) {
-            return monitor;
+
+    mask = table->capacity - 1;
+    for (i = window_hash(window) & mask;
+         table->entries[i].window != None;
+         i = (i + 1) & mask) {
+        if (table->entries[i].window == window) {
+            table->entries[i].pointer = pointer;
+            return;
         }
     }
-    if ((client = window_to_client(window)))
-        return client->monitor;
-
-    return live_monitor;
+    table->entries[i].window = window;
+    table->entries[i].pointer = pointer;
+    table->count += 1;
+    return;
 }
 
 void
-focus_direction(int direction) {
-    Client *selected = live_monitor->selected_client;
-    Client *client = NULL;
-    Client *client_aux;
-    Client *next;
-    uint best_score = UINT_MAX;
+window_table_remove(WindowTable *table, Window window) {
+    uint mask = table->capacity - 1;
+    uint i;
 
-    if (!selected)
+    if (table->count == 0)
         return;
 
-    next = selected->next;
-    if (!next)
-        next = selected->monitor->clients;
-    for (client_aux = next; client_aux != selected; client_aux = next) {
-        int client_score;
-        int dist;
+    for (i = window_hash(window) & mask;
+         table->entries[i].window != window;
+         i = (i + 1) & mask) {
+        if (table->entries[i].window == None)
+            return;
+    }
 
-        next = client_aux->next;
-        if (!next)
-            next = selected->monitor->clients;
+    /* backward shift deletion: move up entries that probed past the hole,
+     * so lookups never need tombstones */
+    for (uint j = (i + 1) & mask;
+              table->entries[j].window != None;
+              j = (j + 1) & mask) {
+        uint home = window_hash(table->entries[j].window) & mask;
+        bool between = i <= j ? (i < home && home <= j)
+                              : (i < home || home <= j);
+        if (!between) {
+            table->entries[i] = table->entries[j];
+            i = j;
+        }
+    }
+    table->entries[i].window = None;
+    table->entries[i].pointer = NULL;
+    table->count -= 1;
+    return;
+}
 
-        if (!client_is_visible(client_aux) || client_aux->is_floating)
-            continue;
+Client *
+window_to_client(Window window) {
+    return window_table_lookup(&client_windows, window);
+}
 
-        switch (direction) {
-        case 0: // left (has preference -1)
-            dist = selected->x - client_aux->x - client_aux->w;
-            client_score = MIN(abs(dist), abs(dist + selected->monitor->win_w));
-            client_score += abs(selected->y - client_aux->y) - 1;
-            break;
-        case 1: // right
-            dist = client_aux->x - selected->x - selected->w;
-            client_score = MIN(abs(dist), abs(dist + selected->monitor->win_w));
-            client_score += abs(client_aux->y - selected->y);
-            break;
-        case 2: // up (has preference -1)
-            dist = selected->y - client_aux->y - client_aux->h;
-            client_score = MIN(abs(dist), abs(dist + selected->monitor->win_h));
-            client_score += abs(selected->x - client_aux->x) - 1;
-            break;
-        default:
-        case 3: // down
-            dist = client_aux->y - selected->y - selected->h;
-            client_score = MIN(abs(dist), abs(dist + selected->monitor->win_h));
-            client_score += abs(client_aux->x - selected->x);
-            break;
-        }
+Monitor *
+window_to_monitor(Window window) {
+    Client *client;
+    Monitor *monitor;
 
-        if ((uint)client_score < best_score) {
-            best_score = (uint)client_score;
-            client = client_aux;
+    if (window == root) {
+        int x;
+        int y;
+        if (get_root_pointer(&x, &y)) {
+            monitor = rectangle_to_monitor(x, y, 1, 1);
+            return monitor;
         }
     }
+    if ((monitor = window_table_lookup(&bar_windows, window)))
+        return monitor;
+    if ((client = window_to_client(window)))
+        return client->monitor;
 
-    if (client && client != selected) {
-        client_focus(client);
-        monitor_restack(client->monitor);
-    }
-    return;
+    return live_monitor;
 }
 
 void
@@ -3699,46 +5747,13 @@ set_layout(const Layout *layout) {
     if (monitor->selected_client)
         monitor_arrange(monitor);
     else
-        monitor_draw_bars(monitor);
-    return;
-}
-
-void
-focus_next(bool direction) {
-    Monitor *monitor;
-    Client *client;
-
-    monitor = live_monitor;
-    client = monitor->selected_client;
-    while (client == NULL && monitor->next) {
-        monitor = monitor->next;
-        monitor_focus(monitor, true);
-        client = monitor->selected_client;
-    }
-    if (client == NULL)
-        return;
-
-    if (direction) {
-        if (client->all_next)
-            client = client->all_next;
-        else
-            client = all_clients;
-    } else {
-        Client *last = client;
-        if (last == all_clients)
-            last = NULL;
-        for (client = all_clients;
-             client->all_next != last;
-             client = client->all_next);
-    }
-    client_focus(client);
+        monitor_set_dirty(monitor, DirtyBars);
     return;
 }
 
 void
 draw_bars(void) {
-    for (Monitor *monitor = monitors; monitor; monitor = monitor->next)
-        monitor_draw_bars(monitor);
+    monitor_set_dirty(NULL, DirtyBars);
     return;
 }
 
@@ -3748,7 +5763,7 @@ scan_windows_once(void) {
     Window parent_return;
     Window *children_return = NULL;
     uint nchildren_return;
-    XWindowAttributes window_attributes;
+    ScanWindow *scans;
     int success;
 
     success = XQueryTree(display, root,
@@ -3757,66 +5772,416 @@ scan_windows_once(void) {
     if (!success)
         return;
 
+    /* every query for every child goes out before the first reply
+     * is read, so adoption costs a round trip in total */
+    scans = xcalloc(nchildren_return + 1, sizeof(*scans));
     for (uint i = 0; i < nchildren_return; i += 1) {
         Window child = children_return[i];
+        ScanWindow *scan = &scans[i];
 
-        if (!XGetWindowAttributes(display, child, &window_attributes))
-            continue;
-        if (window_attributes.override_redirect)
-            continue;
-        if (XGetTransientForHint(display, child, &root_return))
-            continue;
+        scan->attributes = xcb_get_window_attributes(xcb_connection,
+                                                     (xcb_window_t)child);
+        scan->geometry = xcb_get_geometry(xcb_connection,
+                                          (xcb_drawable_t)child);
+        scan->transient = window_property_request(child,
+                                                  XA_WM_TRANSIENT_FOR,
+                                                  XA_WINDOW, 1);
+        scan->state = window_property_request(child, wm_atoms[WM_STATE],
+                                              wm_atoms[WM_STATE], 2);
+    }
 
-        if (window_attributes.map_state == IsViewable
-            || window_state(child) == IconicState) {
-            client_new(child, &window_attributes);
+    for (uint i = 0; i < nchildren_return; i += 1) {
+        ScanWindow *scan = &scans[i];
+        XWindowAttributes *window_attributes = &scan->window_attributes;
+        xcb_get_window_attributes_reply_t *attributes;
+        xcb_get_geometry_reply_t *geometry;
+        xcb_get_property_reply_t *transient;
+        xcb_get_property_reply_t *state;
+        bool iconic = false;
+
+        attributes = xcb_get_window_attributes_reply(xcb_connection,
+                                                     scan->attributes, NULL);
+        geometry = xcb_get_geometry_reply(xcb_connection,
+                                          scan->geometry, NULL);
+        transient = window_property_reply(scan->transient);
+        state = window_property_reply(scan->state);
+
+        if (state && state->format == 32)
+            iconic = *(uint32 *)xcb_get_property_value(state) == IconicState;
+        scan->is_transient = transient && transient->format == 32;
+
+        if (attributes && geometry && !attributes->override_redirect) {
+            window_attributes->x = geometry->x;
+            window_attributes->y = geometry->y;
+            window_attributes->width = geometry->width;
+            window_attributes->height = geometry->height;
+            window_attributes->border_width = geometry->border_width;
+            window_attributes->map_state = attributes->map_state;
+            window_attributes->override_redirect = False;
+
+            scan->adopt = attributes->map_state == IsViewable || iconic;
         }
+
+        free(attributes);
+        free(geometry);
+        free(transient);
+        free(state);
     }
 
-    /* now the transients */
     for (uint i = 0; i < nchildren_return; i += 1) {
-        Window child = children_return[i];
-
-        if (!XGetWindowAttributes(display, child, &window_attributes))
-            continue;
-        if (!XGetTransientForHint(display, child, &root_return))
-            continue;
+        if (scans[i].adopt && !scans[i].is_transient)
+            client_new(children_return[i], &scans[i].window_attributes);
+    }
 
-        if (window_attributes.map_state == IsViewable
-            || window_state(child) == IconicState) {
-            client_new(child, &window_attributes);
-        }
+    /* now the transients */
+    for (uint i = 0; i < nchildren_return; i += 1) {
+        if (scans[i].adopt && scans[i].is_transient)
+            client_new(children_return[i], &scans[i].window_attributes);
     }
 
+    free(scans);
     if (children_return)
         XFree(children_return);
     return;
 }
 
-void
-setup_once(void) {
-    XVisualInfo *visual_infos;
-    XVisualInfo vinfo_template;
-    int nitems_return;
-    long vinfo_mask = VisualScreenMask | VisualDepthMask | VisualClassMask;
-    XSetWindowAttributes window_attributes;
-    Atom UTF8STRING;
-    struct sigaction signal_action;
+/* Fallback fonts matched for odd glyphs are remembered across restarts
+ * in $XDG_CACHE_HOME/dwm/fontmap, so fontconfig is not asked again. */
+bool
+font_cache_path(char *path, size_t size) {
+    char *base;
+    int length;
+
+    if ((base = getenv("XDG_CACHE_HOME")) && base[0]) {
+        length = snprintf(path, size, "%s/dwm", base);
+    } else if ((base = getenv("HOME"))) {
+        length = snprintf(path, size, "%s/.cache", base);
+        if (length < 0 || (size_t)length >= size)
+            return false;
+        mkdir(path, 0755);
+        length = snprintf(path, size, "%s/.cache/dwm", base);
+    } else {
+        return false;
+    }
+    if (length < 0 || (size_t)length >= size)
+        return false;
+    if (mkdir(path, 0700) < 0 && errno != EEXIST)
+        return false;
 
-    /* do not transform children into zombies when they terminate */
-    sigemptyset(&signal_action.sa_mask);
-    signal_action.sa_flags = SA_NOCLDSTOP | SA_NOCLDWAIT | SA_RESTART;
-    signal_action.sa_handler = SIG_IGN;
-    sigaction(SIGCHLD, &signal_action, NULL);
+    path += length;
+    size -= (size_t)length;
+    length = snprintf(path, size, "/fontmap");
+    return length > 0 && (size_t)length < size;
+}
 
-    /* clean up any zombies (inherited from .xinitrc etc) immediately */
-    while (waitpid(-1, NULL, WNOHANG) > 0);
+void
+snapshot_write(void) {
+    SnapshotHeader header = {
+        .magic = SNAPSHOT_MAGIC,
+        .version = SNAPSHOT_VERSION,
+        .number_tags = LENGTH(tags),
+        .number_layouts = LENGTH(layouts),
+        .live_monitor = live_monitor->num,
+    };
+    char fd_text[16];
+    FILE *file;
+    int fd;
 
-    /* init screen */
-    screen = DefaultScreen(display);
-    screen_width = DisplayWidth(display, screen);
-    screen_height = DisplayHeight(display, screen);
-    root = RootWindow(display, screen);
+    if (!(file = tmpfile())) {
+        error(__func__, "Error creating snapshot: %s.\n", strerror(errno));
+        return;
+    }
+
+    for (Monitor *monitor = monitors; monitor; monitor = monitor->next) {
+        header.number_monitors += 1;
+        for (Client *client = monitor->clients; client; client = client->next)
+            header.number_clients += 1;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+
+    for (Monitor *monitor = monitors; monitor; monitor = monitor->next) {
+        SnapshotMonitor record = {0};
+        Pertag *pertag = monitor->pertag;
+
+        record.num = monitor->num;
+        record.tagset[0] = monitor->tagset[0];
+        record.tagset[1] = monitor->tagset[1];
+        record.selected_tags = monitor->selected_tags;
+        record.lay_i = monitor->lay_i;
+        record.layouts[0] = (uint32)(monitor->layout[0] - layouts);
+        record.layouts[1] = (uint32)(monitor->layout[1] - layouts);
+        record.master_fact = monitor->master_fact;
+        record.number_masters = monitor->number_masters;
+        if (monitor->selected_client)
+            record.selected_client = (uint32)monitor->selected_client->window;
+        record.show_top_bar = monitor->show_top_bar;
+        record.show_bottom_bar = monitor->show_bottom_bar;
+
+        for (int i = 0; i <= LENGTH(tags); i += 1) {
+            record.pertag_layouts[i][0] = (uint32)(pertag->layouts[i][0] - layouts);
+            record.pertag_layouts[i][1] = (uint32)(pertag->layouts[i][1] - layouts);
+            record.pertag_number_masters[i] = pertag->number_masters[i];
+            record.pertag_master_facts[i] = pertag->master_facts[i];
+            record.pertag_selected_layouts[i] = pertag->selected_layouts[i];
+            record.pertag_top_bars[i] = pertag->top_bars[i];
+            record.pertag_bottom_bars[i] = pertag->bottom_bars[i];
+        }
+        record.pertag_tag = pertag->tag;
+        record.pertag_old_tag = pertag->old_tag;
+
+        fwrite(&record, sizeof(record), 1, file);
+    }
+
+    for (Monitor *monitor = monitors; monitor; monitor = monitor->next) {
+        for (Client *client = monitor->clients; client; client = client->next) {
+            ClientCold *cold = client_cold(client);
+            SnapshotClient record = {0};
+
+            record.window = (uint32)client->window;
+            record.monitor = monitor->num;
+            record.tags = client->tags;
+            for (Client *c = monitor->stack; c && c != client; c = c->stack_next)
+                record.stack_index += 1;
+            record.x = client->x;
+            record.y = client->y;
+            record.w = client->w;
+            record.h = client->h;
+            record.stored_fx = cold->stored_fx;
+            record.stored_fy = cold->stored_fy;
+            record.stored_fw = cold->stored_fw;
+            record.stored_fh = cold->stored_fh;
+            record.is_floating = client->is_floating;
+            record.old_state = cold->old_state;
+
+            fwrite(&record, sizeof(record), 1, file);
+        }
+    }
+
+    if (fflush(file) || ferror(file)) {
+        error(__func__, "Error writing snapshot.\n");
+        fclose(file);
+        return;
+    }
+
+    /* the file stays open, its descriptor is inherited through execvp */
+    fd = fileno(file);
+    fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) & ~FD_CLOEXEC);
+    snprintf(fd_text, sizeof(fd_text), "%d", fd);
+    setenv(SNAPSHOT_ENV, fd_text, 1);
+    return;
+}
+
+/* Puts back what snapshot_write() saved before a restart. Returns false
+ * when there is no usable snapshot, e.g. because config.h changed the
+ * number of tags or layouts. */
+bool
+snapshot_restore(void) {
+    SnapshotHeader header;
+    SnapshotMonitor *snapshot_monitors = NULL;
+    SnapshotClient *snapshot_clients = NULL;
+    const char *fd_text;
+    bool restored = false;
+    FILE *file;
+    int fd;
+
+    if (!(fd_text = getenv(SNAPSHOT_ENV)))
+        return false;
+    fd = atoi(fd_text);
+    unsetenv(SNAPSHOT_ENV);
+
+    if (!(file = fdopen(fd, "rb"))) {
+        close(fd);
+        return false;
+    }
+    rewind(file);
+
+    if (fread(&header, sizeof(header), 1, file) == 1
+        && header.magic == SNAPSHOT_MAGIC
+        && header.version == SNAPSHOT_VERSION
+        && header.number_tags == LENGTH(tags)
+        && header.number_layouts == LENGTH(layouts)
+        && header.number_monitors <= (1 << 10)
+        && header.number_clients <= (1 << 20)) {
+        snapshot_monitors = xcalloc(header.number_monitors + 1,
+                                    sizeof(*snapshot_monitors));
+        snapshot_clients = xcalloc(header.number_clients + 1,
+                                   sizeof(*snapshot_clients));
+
+        restored = fread(snapshot_monitors, sizeof(*snapshot_monitors),
+                         header.number_monitors, file)
+                   == header.number_monitors
+                   && fread(snapshot_clients, sizeof(*snapshot_clients),
+                            header.number_clients, file)
+                      == header.number_clients;
+    }
+    fclose(file);
+
+    if (restored)
+        snapshot_apply(&header, snapshot_monitors, snapshot_clients);
+    else
+        error(__func__, "Ignoring invalid snapshot.\n");
+
+    free(snapshot_monitors);
+    free(snapshot_clients);
+    return restored;
+}
+
+void
+snapshot_apply(SnapshotHeader *header,
+               SnapshotMonitor *snapshot_monitors,
+               SnapshotClient *snapshot_clients) {
+    SnapshotClient **stacking;
+    uint32 number_stacking = 0;
+    Monitor *monitor;
+
+    /* walk backwards, client_attach() prepends */
+    stacking = xcalloc(header->number_clients + 1, sizeof(*stacking));
+    for (uint32 i = header->number_clients; i-- > 0;) {
+        SnapshotClient *record = &snapshot_clients[i];
+        Client *client = window_to_client(record->window);
+        ClientCold *cold;
+
+        if (!client)
+            continue;
+
+        client_detach(client);
+        client_detach_stack(client);
+        if ((monitor = num_to_monitor(record->monitor)))
+            client->monitor = monitor;
+        if (record->tags & TAGMASK)
+            client->tags = record->tags & TAGMASK;
+
+        cold = client_cold(client);
+        client->x = record->x;
+        client->y = record->y;
+        client->w = record->w;
+        client->h = record->h;
+        cold->stored_fx = record->stored_fx;
+        cold->stored_fy = record->stored_fy;
+        cold->stored_fw = record->stored_fw;
+        cold->stored_fh = record->stored_fh;
+        client->is_floating = record->is_floating;
+        cold->old_state = record->old_state;
+
+        client_attach(client);
+        client_set_client_tag_prop(client);
+        stacking[number_stacking++] = record;
+    }
+
+    qsort(stacking, number_stacking, sizeof(*stacking),
+          snapshot_compare_stack);
+    for (uint32 i = 0; i < number_stacking; i += 1)
+        client_attach_stack(window_to_client(stacking[i]->window));
+    free(stacking);
+
+    for (uint32 i = 0; i < header->number_monitors; i += 1) {
+        SnapshotMonitor *record = &snapshot_monitors[i];
+        Client *selected;
+        Pertag *pertag;
+
+        if (!(monitor = num_to_monitor(record->num)))
+            continue;
+        pertag = monitor->pertag;
+
+        if (record->tagset[0] & TAGMASK)
+            monitor->tagset[0] = record->tagset[0] & TAGMASK;
+        if (record->tagset[1] & TAGMASK)
+            monitor->tagset[1] = record->tagset[1] & TAGMASK;
+        monitor->selected_tags = record->selected_tags & 1;
+        monitor->lay_i = record->lay_i & 1;
+        monitor->layout[0] = snapshot_layout(record->layouts[0]);
+        monitor->layout[1] = snapshot_layout(record->layouts[1]);
+        strncpy(monitor->layout_symbol,
+                monitor->layout[monitor->lay_i]->symbol,
+                sizeof(monitor->layout_symbol) - 1);
+        monitor->master_fact = record->master_fact;
+        monitor->number_masters = record->number_masters;
+
+        for (int j = 0; j <= LENGTH(tags); j += 1) {
+            pertag->layouts[j][0] = snapshot_layout(record->pertag_layouts[j][0]);
+            pertag->layouts[j][1] = snapshot_layout(record->pertag_layouts[j][1]);
+            pertag->number_masters[j] = record->pertag_number_masters[j];
+            pertag->master_facts[j] = record->pertag_master_facts[j];
+            pertag->selected_layouts[j] = record->pertag_selected_layouts[j] & 1;
+            pertag->top_bars[j] = record->pertag_top_bars[j];
+            pertag->bottom_bars[j] = record->pertag_bottom_bars[j];
+        }
+        if (record->pertag_tag <= LENGTH(tags))
+            pertag->tag = record->pertag_tag;
+        if (record->pertag_old_tag <= LENGTH(tags))
+            pertag->old_tag = record->pertag_old_tag;
+
+        monitor->show_top_bar = record->show_top_bar;
+        monitor->show_bottom_bar = record->show_bottom_bar;
+        monitor_update_bar_position(monitor);
+        XMoveResizeWindow(display, monitor->top_bar_window,
+                          monitor->win_x, monitor->top_bar_y,
+                          (uint)monitor->win_w, bar_height);
+        XMoveResizeWindow(display, monitor->bottom_bar_window,
+                          monitor->win_x, monitor->bottom_bar_y,
+                          (uint)monitor->win_w, bar_height);
+
+        selected = window_to_client(record->selected_client);
+        if (selected && selected->monitor == monitor)
+            monitor->selected_client = selected;
+    }
+
+    if ((monitor = num_to_monitor(header->live_monitor)))
+        live_monitor = monitor;
+    monitor_arrange(NULL);
+    client_focus(live_monitor->selected_client);
+    return;
+}
+
+/* highest stack index first, client_attach_stack() prepends */
+int
+snapshot_compare_stack(const void *a, const void *b) {
+    const SnapshotClient *client_a = *(SnapshotClient *const *)a;
+    const SnapshotClient *client_b = *(SnapshotClient *const *)b;
+
+    if (client_a->stack_index > client_b->stack_index)
+        return -1;
+    return client_a->stack_index < client_b->stack_index;
+}
+
+const Layout *
+snapshot_layout(uint32 index) {
+    if (index < LENGTH(layouts))
+        return &layouts[index];
+    return &layouts[0];
+}
+
+void
+setup_once(void) {
+    XVisualInfo *visual_infos;
+    XVisualInfo vinfo_template;
+    int nitems_return;
+    long vinfo_mask = VisualScreenMask | VisualDepthMask | VisualClassMask;
+    XSetWindowAttributes window_attributes;
+    Atom UTF8STRING;
+    struct sigaction signal_action;
+
+    /* do not transform children into zombies when they terminate */
+    sigemptyset(&signal_action.sa_mask);
+    signal_action.sa_flags = SA_NOCLDSTOP | SA_NOCLDWAIT | SA_RESTART;
+    signal_action.sa_handler = SIG_IGN;
+    sigaction(SIGCHLD, &signal_action, NULL);
+
+    /* clean up any zombies (inherited from .xinitrc etc) immediately */
+    while (waitpid(-1, NULL, WNOHANG) > 0);
+
+#ifdef STATS
+    /* no SA_RESTART, so poll() in event_loop wakes up to publish */
+    signal_action.sa_flags = 0;
+    signal_action.sa_handler = stats_signal;
+    sigaction(SIGUSR1, &signal_action, NULL);
+#endif
+
+    /* init screen */
+    screen = DefaultScreen(display);
+    screen_width = DisplayWidth(display, screen);
+    screen_height = DisplayHeight(display, screen);
+    root = RootWindow(display, screen);
 
     vinfo_template.screen = screen;
     vinfo_template.depth = 32;
@@ -3847,15 +6212,28 @@ setup_once(void) {
         color_map = DefaultColormap(display, screen);
     }
 
-    drw = drw_create(display, screen, root,
-                     (uint)screen_width, (uint)screen_height,
+    /* only used for measuring text and loading resources,
+     * every bar draws into a pixmap of its own */
+    drw = drw_create(display, screen, root, 1, 1,
                      visual, (uint)depth, color_map);
     if (!drw_fontset_create(drw, fonts, LENGTH(fonts))) {
         error(__func__, "Error loading fonts for dwm.\n");
         exit(EXIT_FAILURE);
     }
+    if (!font_cache_path(font_cache, sizeof(font_cache)))
+        font_cache[0] = '\0';
+    else
+        drw_fontmap_load(drw, font_cache);
+    rules_compile();
     text_padding = (int) ((double) drw->fonts->h / 2.2);
     bar_height = drw->fonts->h;
+#ifdef XRANDR
+    {
+        int error_base;
+        if (!XRRQueryExtension(display, &randr_event_base, &error_base))
+            randr_event_base = -1;
+    }
+#endif /* XRANDR */
     update_geometry();
 
     /* init atoms */
@@ -3874,7 +6252,9 @@ setup_once(void) {
     NET_INTERN_ATOM(NET_WM_WINDOW_TYPE);
     NET_INTERN_ATOM(NET_WM_WINDOW_TYPE_DIALOG);
     NET_INTERN_ATOM(NET_CLIENT_LIST);
+    NET_INTERN_ATOM(NET_CLIENT_LIST_STACKING);
     NET_INTERN_ATOM(NET_CLIENT_INFO);
+    status_pid_atom = XInternAtom(display, STATUS_PID_PROPERTY, False);
 
     /* init cursors */
     cursor[CursorNormal] = drw_cur_create(drw, XC_left_ptr);
@@ -3888,8 +6268,10 @@ setup_once(void) {
 
     /* init bars */
     configure_bars_windows();
+    trace_open();
+    status_socket_open();
     status_update();
-    monitor_draw_bars(live_monitor);
+    monitor_set_dirty(live_monitor, DirtyBars);
 
     /* supporting window for NET_SUPPORTING_WM_CHECK */
     wm_check_window = XCreateSimpleWindow(display, root, 0, 0, 1, 1, 0, 0, 0);
@@ -3907,6 +6289,7 @@ setup_once(void) {
     XChangeProperty(display, root, net_atoms[NET_SUPPORTED], XA_ATOM, 32,
         PropModeReplace, (uchar *)net_atoms, NET_LAST);
     XDeleteProperty(display, root, net_atoms[NET_CLIENT_LIST]);
+    XDeleteProperty(display, root, net_atoms[NET_CLIENT_LIST_STACKING]);
     XDeleteProperty(display, root, net_atoms[NET_CLIENT_INFO]);
 
     /* select events */
@@ -3919,11 +6302,92 @@ setup_once(void) {
     XChangeWindowAttributes(display, root,
                             CWEventMask|CWCursor, &window_attributes);
     XSelectInput(display, root, window_attributes.event_mask);
+#ifdef XRANDR
+    if (randr_event_base >= 0) {
+        XRRSelectInput(display, root,
+                       RRScreenChangeNotifyMask|RRCrtcChangeNotifyMask
+                       |RROutputChangeNotifyMask);
+    }
+#endif /* XRANDR */
     grab_keys();
     client_focus(NULL);
     return;
 }
 
+void
+bar_begin(Bar *bar, int width) {
+    if (bar->drw->w != (uint)width) {
+        drw_resize(bar->drw, (uint)width, bar_height);
+        bar_invalidate(bar);
+    }
+    bar->damage_x0 = width;
+    bar->damage_x1 = 0;
+    return;
+}
+
+void
+bar_end(Bar *bar, Window window, int width) {
+    int x0 = MAX(bar->damage_x0, 0);
+    int x1 = MIN(bar->damage_x1, width);
+
+    if (x0 < x1)
+        drw_map(bar->drw, window, x0, 0, (uint)(x1 - x0), bar_height);
+    return;
+}
+
+uint64
+bar_hash(uint64 hash, const void *data, size_t size) {
+    const uchar *bytes = data;
+
+    for (size_t i = 0; i < size; i += 1) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3u;
+    }
+    return hash;
+}
+
+void
+bar_invalidate(Bar *bar) {
+    Drw *bar_drw = bar->drw;
+    int damage_x0 = bar->damage_x0;
+    int damage_x1 = bar->damage_x1;
+
+    memset(bar, 0, sizeof(*bar));
+    bar->drw = bar_drw;
+    bar->damage_x0 = damage_x0;
+    bar->damage_x1 = damage_x1;
+    return;
+}
+
+/* Records what a segment now shows and tells whether it has to be
+ * painted. Stored hashes are never zero, so zeroed segments always
+ * compare as stale. */
+bool
+bar_segment(Bar *bar, BarSegment *segment, int x, int w, uint64 hash) {
+    hash |= 1;
+    if (segment->x == x && segment->w == w && segment->hash == hash)
+        return false;
+
+    segment->x = x;
+    segment->w = w;
+    segment->hash = hash;
+    if (w <= 0)
+        return false;
+
+    bar->damage_x0 = MIN(bar->damage_x0, x);
+    bar->damage_x1 = MAX(bar->damage_x1, x + w);
+    return true;
+}
+
+Drw *
+create_bar_drw(int width) {
+    Drw *bar_drw = drw_create(display, screen, root,
+                              (uint)width, bar_height,
+                              visual, (uint)depth, color_map);
+    drw_setfontset(bar_drw, drw->fonts);
+    return bar_drw;
+}
+
 void
 configure_bars_windows(void) {
     XSetWindowAttributes window_attributes = {
@@ -3948,6 +6412,8 @@ configure_bars_windows(void) {
                                    0, depth, InputOutput, visual,
                                    value_mask, &window_attributes);
             monitor->top_bar_window = window;
+            window_table_insert(&bar_windows, window, monitor);
+            monitor->bars[BarTop].drw = create_bar_drw(monitor->win_w);
 
             XDefineCursor(display,monitor->top_bar_window,
                           cursor[CursorNormal]->cursor);
@@ -3961,6 +6427,8 @@ configure_bars_windows(void) {
                                    0, depth, InputOutput, visual,
                                    value_mask, &window_attributes);
             monitor->bottom_bar_window = window;
+            window_table_insert(&bar_windows, window, monitor);
+            monitor->bars[BarBottom].drw = create_bar_drw(monitor->win_w);
 
             XDefineCursor(display, monitor->bottom_bar_window,
                           cursor[CursorNormal]->cursor);
@@ -3971,10 +6439,269 @@ configure_bars_windows(void) {
     return;
 }
 
+#ifdef XRANDR
+/* Drags step once per refresh of the monitor they happen on. */
+uint
+monitor_mode_milis(XRRScreenResources *resources, RRMode id) {
+    XRRModeInfo *mode = NULL;
+    double lines;
+    double rate;
+
+    for (int i = 0; i < resources->nmode; i += 1) {
+        if (resources->modes[i].id == id)
+            mode = &resources->modes[i];
+    }
+    if (!mode || !mode->hTotal || !mode->vTotal)
+        return DRAG_FRAME_MILIS;
+
+    lines = (double)mode->vTotal;
+    if (mode->modeFlags & RR_DoubleScan)
+        lines *= 2;
+    if (mode->modeFlags & RR_Interlace)
+        lines /= 2;
+    rate = (double)mode->dotClock / ((double)mode->hTotal*lines);
+    if (rate < 1.0)
+        return DRAG_FRAME_MILIS;
+    return (uint)MAX(1000.0 / rate, 1.0);
+}
+
+/* Without RandR events monitors come from Xinerama: the rate is that of
+ * the mode of the CRTC whose origin is that of the monitor. */
+void
+monitor_update_frame_milis(void) {
+    XRRScreenResources *resources;
+
+    for (Monitor *monitor = monitors; monitor; monitor = monitor->next)
+        monitor->frame_milis = DRAG_FRAME_MILIS;
+
+    if (!(resources = XRRGetScreenResourcesCurrent(display, root)))
+        return;
+
+    for (int i = 0; i < resources->ncrtc; i += 1) {
+        XRRCrtcInfo *crtc;
+
+        if (!(crtc = XRRGetCrtcInfo(display, resources, resources->crtcs[i])))
+            continue;
+        for (Monitor *monitor = monitors; monitor; monitor = monitor->next) {
+            if (crtc->mode != None
+                && crtc->x == monitor->mon_x && crtc->y == monitor->mon_y) {
+                monitor->frame_milis = monitor_mode_milis(resources,
+                                                          crtc->mode);
+            }
+        }
+        XRRFreeCrtcInfo(crtc);
+    }
+    XRRFreeScreenResources(resources);
+    return;
+}
+#endif /* XRANDR */
+
+/* Moves the bars and fullscreen windows of the monitors whose geometry
+ * changed, and arranges only those: all of them if the screen resized. */
+void
+update_geometry_apply(bool resized) {
+    if (!update_geometry() && !resized)
+        return;
+
+    configure_bars_windows();
+    for (Monitor *mon = monitors; mon; mon = mon->next) {
+        if (!mon->geometry_changed && !resized)
+            continue;
+        mon->geometry_changed = false;
+
+        for (Client *client = mon->clients; client; client = client->next) {
+            if (client->is_fullscreen && !client->is_fake_fullscreen) {
+                client_resize_apply(client,
+                                    mon->mon_x, mon->mon_y,
+                                    mon->mon_w, mon->mon_h);
+            }
+        }
+        XMoveResizeWindow(display, mon->top_bar_window,
+                          mon->win_x, mon->top_bar_y,
+                          (uint)mon->win_w, bar_height);
+        XMoveResizeWindow(display, mon->bottom_bar_window,
+                          mon->win_x, mon->bottom_bar_y,
+                          (uint)mon->win_w, bar_height);
+        monitor_arrange(mon);
+    }
+    client_focus(NULL);
+    return;
+}
+
+#ifdef XRANDR
+bool
+update_geometry_has_output(RandrOutput *outputs, int number_outputs,
+                           RROutput output) {
+    for (int i = 0; i < number_outputs; i += 1) {
+        if (outputs[i].output == output)
+            return true;
+    }
+    return false;
+}
+
+/* milliseconds until the pending geometry update, -1 for none and 0
+ * once it was just applied */
+int
+update_geometry_timeout(void) {
+    struct timespec now;
+    long long left;
+
+    if (!geometry_pending)
+        return -1;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    left = (geometry_deadline.tv_sec - now.tv_sec)*1000LL
+           + (geometry_deadline.tv_nsec - now.tv_nsec) / 1000000;
+    if (left > 0)
+        return (int)left;
+
+    geometry_pending = false;
+    update_geometry_apply(false);
+    return 0;
+}
+
+/* Every connected output with a CRTC is one monitor, identified by its
+ * output: a monitor keeps its clients and pertag state for as long as
+ * that output stays, wherever it moves. Outputs mirroring an earlier one
+ * are skipped. With nothing connected the monitors are left alone. */
+int
+update_geometry_randr(void) {
+    XRRScreenResources *resources;
+    RandrOutput *outputs;
+    int number_outputs = 0;
+    Monitor *target;
+    Monitor *next;
+    bool dirty = false;
+    int num = 0;
+
+    if (!(resources = XRRGetScreenResourcesCurrent(display, root)))
+        return false;
+
+    outputs = xcalloc((size_t)MAX(resources->noutput, 1), sizeof(*outputs));
+    for (int i = 0; i < resources->noutput; i += 1) {
+        XRROutputInfo *output;
+        XRRCrtcInfo *crtc;
+        bool mirror = false;
+
+        output = XRRGetOutputInfo(display, resources, resources->outputs[i]);
+        if (!output)
+            continue;
+        if (output->connection != RR_Connected || output->crtc == None) {
+            XRRFreeOutputInfo(output);
+            continue;
+        }
+        crtc = XRRGetCrtcInfo(display, resources, output->crtc);
+        XRRFreeOutputInfo(output);
+        if (!crtc)
+            continue;
+
+        for (int j = 0; j < number_outputs; j += 1) {
+            if (outputs[j].x == crtc->x && outputs[j].y == crtc->y
+                && outputs[j].w == (int)crtc->width
+                && outputs[j].h == (int)crtc->height) {
+                mirror = true;
+            }
+        }
+        if (!mirror && crtc->mode != None) {
+            outputs[number_outputs] = (RandrOutput){
+                .output = resources->outputs[i],
+                .x = crtc->x, .y = crtc->y,
+                .w = (int)crtc->width, .h = (int)crtc->height,
+                .milis = monitor_mode_milis(resources, crtc->mode),
+            };
+            number_outputs += 1;
+        }
+        XRRFreeCrtcInfo(crtc);
+    }
+    XRRFreeScreenResources(resources);
+
+    if (number_outputs == 0) {
+        free(outputs);
+        return false;
+    }
+
+    /* outputs already shown keep their monitor */
+    for (int i = 0; i < number_outputs; i += 1) {
+        RandrOutput *output = &outputs[i];
+        Monitor *monitor;
+
+        for (monitor = monitors;
+             monitor && monitor->output != output->output;
+             monitor = monitor->next);
+        if (!monitor) {
+            /* the first monitor made before RandR was asked adopts one */
+            for (monitor = monitors;
+                 monitor && monitor->output != None;
+                 monitor = monitor->next);
+        }
+        if (!monitor) {
+            Monitor **last;
+            for (last = &monitors; *last; last = &(*last)->next);
+            monitor = *last = create_monitor();
+        }
+
+        monitor->output = output->output;
+        monitor->frame_milis = output->milis;
+        if (monitor->mon_x != output->x || monitor->mon_y != output->y
+            || monitor->mon_w != output->w || monitor->mon_h != output->h) {
+            dirty = true;
+            monitor->geometry_changed = true;
+            monitor->mon_x = monitor->win_x = output->x;
+            monitor->mon_y = monitor->win_y = output->y;
+            monitor->mon_w = monitor->win_w = output->w;
+            monitor->mon_h = monitor->win_h = output->h;
+            monitor_update_bar_position(monitor);
+        }
+    }
+
+    /* monitors whose output went away hand their clients over to the
+     * first one that stays */
+    for (target = monitors;
+         target && !update_geometry_has_output(outputs, number_outputs,
+                                               target->output);
+         target = target->next);
+    for (Monitor *monitor = monitors; monitor; monitor = next) {
+        Client *client;
+
+        next = monitor->next;
+        if (update_geometry_has_output(outputs, number_outputs,
+                                       monitor->output)) {
+            continue;
+        }
+        while ((client = monitor->clients)) {
+            client_detach(client);
+            client_detach_stack(client);
+            client->monitor = target;
+            client_attach(client);
+            client_attach_stack(client);
+        }
+        target->geometry_changed = true;
+        if (monitor == live_monitor)
+            live_monitor = target;
+        monitor_cleanup_monitor(monitor);
+        dirty = true;
+    }
+
+    for (Monitor *monitor = monitors; monitor; monitor = monitor->next) {
+        monitor->num = num;
+        num += 1;
+    }
+    free(outputs);
+    return dirty;
+}
+#endif /* XRANDR */
+
 int
 update_geometry(void) {
     bool dirty = false;
 
+#ifdef XRANDR
+    if (randr_event_base >= 0 && (dirty = update_geometry_randr())) {
+        live_monitor = window_to_monitor(root);
+        return dirty;
+    }
+    if (randr_event_base >= 0 && monitors)
+        return dirty;
+#endif /* XRANDR */
 #ifdef XINERAMA
     if (XineramaIsActive(display)) {
         XineramaScreenInfo *screen_info;
@@ -4024,6 +6751,7 @@ update_geometry(void) {
             if (k >= number_monitors
                 || unique_x || unique_y || unique_w || unique_h) {
                 dirty = true;
+                monitor->geometry_changed = true;
                 monitor->num = k;
                 monitor->mon_x = monitor->win_x = unique[k].x_org;
                 monitor->mon_y = monitor->win_y = unique[k].y_org;
@@ -4044,8 +6772,9 @@ update_geometry(void) {
 
             while ((client = monitor->clients)) {
                 dirty = true;
+                monitors->geometry_changed = true;
                 monitor->clients = client->next;
-                all_clients = client->all_next;
+                all_clients = client_cold(client)->all_next;
                 client_detach_stack(client);
                 client->monitor = monitors;
                 client_attach(client);
@@ -4065,6 +6794,7 @@ update_geometry(void) {
         if (monitors->mon_w != screen_width
             || monitors->mon_h != screen_height) {
             dirty = true;
+            monitors->geometry_changed = true;
             monitors->mon_w = monitors->win_w = screen_width;
             monitors->mon_h = monitors->win_h = screen_height;
             monitor_update_bar_position(monitors);
@@ -4074,6 +6804,9 @@ update_geometry(void) {
         live_monitor = monitors;
         live_monitor = window_to_monitor(root);
     }
+#ifdef XRANDR
+    monitor_update_frame_milis();
+#endif /* XRANDR */
     return dirty;
 }
 
@@ -4093,36 +6826,744 @@ update_numlock_mask(void) {
     XFreeModifiermap(modmap);
 }
 
-void
+/* Returns whether either status has to be drawn again, blocks that kept
+ * their text are neither measured nor redrawn. */
+bool
 status_update(void) {
+    char text[sizeof(status_top.text)];
+    char *bottom = "";
     char *separator;
+    bool changed;
 
-    if (!window_text_property(root, XA_WM_NAME,
-                              status_top.text, sizeof(status_top.text))) {
+    /* the socket replaces WM_NAME once a status program has used it */
+    if (status_socket_active)
+        return false;
+
+    if (!window_text_property(root, XA_WM_NAME, text, sizeof(text))) {
         error(__func__, "Error getting XA_WM_NAME property.\n");
-        strcpy(status_top.text, "dwm-"VERSION);
-        strcpy(status_top.text, "dwm-"VERSION);
-        status_top.pixels = get_text_pixels(status_top.text) - text_padding + 2;
-        status_bottom.pixels = status_top.pixels;
-        return;
+        strcpy(text, "dwm-"VERSION);
+    } else if (trace_fd >= 0) {
+        trace_write(TraceStatus, text, strlen(text) + 1);
     }
 
-    separator = strchr(status_top.text, DWM_BAR_SEPARATOR);
+    separator = strchr(text, DWM_BAR_SEPARATOR);
     if (separator) {
-        ulong top_length = (ulong) (separator - status_top.text);
-        ulong bottom_length = sizeof (status_bottom.text) - top_length;
         *separator = '\0';
-        separator += 1;
-        memcpy(status_bottom.text, separator, bottom_length);
+        bottom = separator + 1;
+    }
+
+    changed = status_parse_text(&status_top, text);
+    changed = status_parse_text(&status_bottom, bottom) || changed;
+    return changed;
+}
+
+/* Status socket: a unix datagram socket in $XDG_RUNTIME_DIR, announced
+ * to children in $DWM_STATUS_SOCKET. Each line of a datagram updates one
+ * block and leaves the others as they are:
+ *     <top|bottom> <block> <signal> <scheme> <text>
+ * An empty text removes the block. */
+void
+status_socket_open(void) {
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    char *directory = getenv("XDG_RUNTIME_DIR");
+    int length;
+    int fd;
+
+    if (directory && directory[0]) {
+        length = snprintf(address.sun_path, sizeof(address.sun_path),
+                          "%s/dwm-status%s", directory, DisplayString(display));
     } else {
-        memset(status_bottom.text, 0, sizeof(status_bottom.text));
+        /* a shared /tmp: only inside a directory of our own, so that
+         * the unlink() below never touches another user's file */
+        char own_directory[64];
+        struct stat info;
+
+        snprintf(own_directory, sizeof(own_directory),
+                 "/tmp/dwm-%d", (int)getuid());
+        if (mkdir(own_directory, 0700) < 0 && errno != EEXIST) {
+            error(__func__, "Error creating %s: %s\n",
+                            own_directory, strerror(errno));
+            return;
+        }
+        if (lstat(own_directory, &info) < 0 || !S_ISDIR(info.st_mode)
+            || info.st_uid != getuid() || (info.st_mode & 077)) {
+            error(__func__, "%s is not a private directory.\n",
+                            own_directory);
+            return;
+        }
+        length = snprintf(address.sun_path, sizeof(address.sun_path),
+                          "%s/status%s", own_directory,
+                          DisplayString(display));
+    }
+    if (length < 0 || (size_t)length >= sizeof(address.sun_path)) {
+        error(__func__, "Status socket path is too long.\n");
+        return;
     }
 
-    status_parse_text(&status_top);
-    status_parse_text(&status_bottom);
+    if ((fd = socket(AF_UNIX, SOCK_DGRAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0)) < 0) {
+        error(__func__, "Error creating status socket: %s\n", strerror(errno));
+        return;
+    }
+    unlink(address.sun_path);
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        error(__func__, "Error binding %s: %s\n",
+                        address.sun_path, strerror(errno));
+        close(fd);
+        return;
+    }
+
+    memcpy(status_socket_path, address.sun_path, sizeof(status_socket_path));
+    setenv(STATUS_SOCKET_ENV, status_socket_path, 1);
+    poll_fds[FdStatusSocket].fd = fd;
+    poll_fds[FdStatusSocket].events = POLLIN;
     return;
 }
 
+void
+status_socket_close(void) {
+    if (poll_fds[FdStatusSocket].fd < 0)
+        return;
+    close(poll_fds[FdStatusSocket].fd);
+    poll_fds[FdStatusSocket].fd = -1;
+    unlink(status_socket_path);
+    return;
+}
+
+/* Drains every pending datagram, then lays out the bars that got one. */
+void
+status_socket_read(void) {
+    char buffer[STATUS_MAX_BLOCKS*(STATUS_BLOCK_SIZE + 32)];
+    bool changed[2] = {false, false};
+    ssize_t length;
+
+    while ((length = recv(poll_fds[FdStatusSocket].fd,
+                          buffer, sizeof(buffer) - 1, 0)) >= 0) {
+        char *newline;
+
+        buffer[length] = '\0';
+        for (char *line = buffer; line; line = newline) {
+            int bar;
+
+            if ((newline = strchr(line, '\n')))
+                *newline++ = '\0';
+            if ((bar = status_socket_message(line)) < 0)
+                continue;
+            changed[bar] = true;
+            if (trace_fd >= 0)
+                trace_write(TraceStatusBlock, line, strlen(line) + 1);
+        }
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        error(__func__, "Error reading status socket: %s\n", strerror(errno));
+
+    if (!changed[BarTop] && !changed[BarBottom])
+        return;
+
+    status_socket_active = true;
+    changed[BarTop] = changed[BarTop]
+                      && status_socket_build(&status_top, status_blocks[BarTop]);
+    changed[BarBottom] = changed[BarBottom]
+                         && status_socket_build(&status_bottom,
+                                                status_blocks[BarBottom]);
+    if (changed[BarTop] || changed[BarBottom])
+        monitor_set_dirty(live_monitor, DirtyBars);
+    return;
+}
+
+/* Returns the bar the line updates or -1 if it is not valid. */
+int
+status_socket_message(char *line) {
+    char bar_name[8];
+    int id;
+    int signal;
+    int color;
+    int offset;
+    int bar;
+    StatusBlock *block;
+
+    if (sscanf(line, "%7s %d %d %d %n",
+               bar_name, &id, &signal, &color, &offset) != 4) {
+        return -1;
+    }
+    if (!strcmp(bar_name, "top"))
+        bar = BarTop;
+    else if (!strcmp(bar_name, "bottom"))
+        bar = BarBottom;
+    else
+        return -1;
+
+    if (id < 0 || id >= STATUS_MAX_BLOCKS
+        || color < 0 || color >= LENGTH(colors)) {
+        return -1;
+    }
+
+    block = &status_blocks[bar][id];
+    block->used = line[offset] != '\0';
+    block->signal = signal;
+    block->scheme = color;
+    snprintf(block->text, sizeof(block->text), "%s", &line[offset]);
+    return bar;
+}
+
+/* Lays out the used blocks in order of their ids, as status_parse_text
+ * does for WM_NAME. Returns whether anything visible changed. */
+bool
+status_socket_build(StatusBar *status_bar, StatusBlock *sent) {
+    BlockSignal *blocks = status_bar->blocks_signal;
+    int number_blocks = 0;
+    int total_pixels = 0;
+    size_t used = 0;
+    bool changed = false;
+
+    for (int id = 0; id < STATUS_MAX_BLOCKS; id += 1) {
+        StatusBlock *status_block = &sent[id];
+        char *text = &status_bar->text[used];
+        size_t length;
+
+        if (!status_block->used)
+            continue;
+        length = strlen(status_block->text);
+        if (used + length + 1 > sizeof(status_bar->text))
+            break;
+        memcpy(text, status_block->text, length + 1);
+        used += length + 1;
+
+        status_measure_block(status_bar, number_blocks,
+                             text, status_block->scheme);
+        changed = changed || blocks[number_blocks].dirty;
+        blocks[number_blocks].signal = status_block->signal;
+        blocks[number_blocks].min_x = total_pixels;
+        blocks[number_blocks].max_x = total_pixels
+                                      + blocks[number_blocks].text_pixels;
+        total_pixels = blocks[number_blocks].max_x;
+        number_blocks += 1;
+    }
+    if (number_blocks) {
+        blocks[number_blocks - 1].max_x += 2;
+        total_pixels += 2;
+    }
+
+    changed = changed || status_bar->number_blocks != number_blocks;
+    status_bar->number_blocks = number_blocks;
+    status_bar->pixels = total_pixels;
+    /* WM_NAME is parsed again if the socket is ever left */
+    status_bar->hash = 0;
+    return changed;
+}
+
+/* Returns the pid of STATUS_PROGRAM, resolved once and then kept until
+ * the program exits or announces another one. */
+pid_t
+status_program_pid(void) {
+    time_t now;
+
+    if (status_pid > 0)
+        return status_pid;
+
+    /* do not fork pidof on every scroll while it is not running */
+    now = time(NULL);
+    if (now == status_pid_lookup)
+        return -1;
+    status_pid_lookup = now;
+
+    if ((status_pid = status_find_pid()) <= 0)
+        return status_pid = -1;
+
+#if defined(__linux__) && defined(SYS_pidfd_open)
+    /* readable once the process exits, event_loop forgets it then */
+    poll_fds[FdStatusPid].fd = (int)syscall(SYS_pidfd_open, status_pid, 0);
+    poll_fds[FdStatusPid].events = POLLIN;
+#endif
+    return status_pid;
+}
+
+/* STATUS_PROGRAM may publish its pid as a CARDINAL in the
+ * _DWM_STATUS_PID root property, otherwise ask pidof(1). */
+pid_t
+status_find_pid(void) {
+    xcb_get_property_reply_t *reply;
+    pid_t pid = -1;
+    int pipefd[2];
+    char buffer[32] = {0};
+
+    reply = window_property_reply(
+        window_property_request(root, status_pid_atom, XA_CARDINAL, 1));
+    if (reply) {
+        if (reply->format == 32)
+            pid = (pid_t)*(uint32 *)xcb_get_property_value(reply);
+        free(reply);
+        if (pid > 0 && kill(pid, 0) == 0)
+            return pid;
+    }
+
+    if (pipe(pipefd) < 0) {
+        error(__func__, "Error creating pipe: %s\n", strerror(errno));
+        return -1;
+    }
+
+    switch (fork()) {
+    case -1:
+        error(__func__, "Error forking: %s\n", strerror(errno));
+        close(pipefd[0]);
+        close(pipefd[1]);
+        return -1;
+    case 0:
+        close(pipefd[0]);
+        dup2(pipefd[1], STDOUT_FILENO);
+        close(pipefd[1]);
+        execlp("pidof", "pidof", "-s", STATUS_PROGRAM, NULL);
+        error(__func__, "Error executing pidof.\n");
+        exit(EXIT_FAILURE);
+    default:
+        close(pipefd[1]);
+        break;
+    }
+
+    if (read(pipefd[0], buffer, sizeof (buffer) - 1) <= 0) {
+        close(pipefd[0]);
+        return -1;
+    }
+    close(pipefd[0]);
+
+    return atoi(buffer);
+}
+
+/* The status program is gone or replaced: whatever comes next may use
+ * WM_NAME again, so it is read back in place of the socket blocks. */
+void
+status_forget_pid(void) {
+    if (poll_fds[FdStatusPid].fd >= 0)
+        close(poll_fds[FdStatusPid].fd);
+    poll_fds[FdStatusPid].fd = -1;
+    status_pid = -1;
+    status_pid_lookup = 0;
+    if (status_socket_active) {
+        status_socket_active = false;
+        if (status_update())
+            monitor_set_dirty(live_monitor, DirtyBars);
+    }
+    return;
+}
+
+/* Sleeps in poll() until one of poll_fds is ready, then handles whatever
+ * the X connection has queued as one batch followed by a single flush. */
+void
+event_loop(void) {
+    static XEvent events[EVENT_BATCH_SIZE];
+
+    poll_fds[FdDisplay].fd = ConnectionNumber(display);
+    poll_fds[FdDisplay].events = POLLIN;
+
+    while (dwm_running) {
+        int number_events;
+        int timeout;
+
+#ifdef STATS
+        if (stats_requested)
+            stats_publish();
+#endif
+
+        /* XPending also flushes requests queued by the last batch. The
+         * other fds are polled on every pass, only without blocking
+         * while X events are queued, so a flood cannot starve them. */
+        timeout = XPending(display) ? 0 : -1;
+#ifdef XRANDR
+        {
+            /* checked on every pass too, so a settled RandR change is
+             * applied even while events keep coming; 0 once applied,
+             * flushed below */
+            int settle = update_geometry_timeout();
+
+            if (timeout != 0)
+                timeout = settle;
+        }
+#endif /* XRANDR */
+        if (poll(poll_fds, FdLast, timeout) < 0) {
+            if (errno == EINTR)
+                continue;
+            error(__func__, "poll: %s\n", strerror(errno));
+            break;
+        }
+        if (poll_fds[FdStatusPid].revents)
+            status_forget_pid();
+        if (poll_fds[FdStatusSocket].revents & POLLIN)
+            status_socket_read();
+
+        number_events = event_read_batch(events, EVENT_BATCH_SIZE);
+        number_events = event_compress(events, number_events);
+        for (int i = 0; i < number_events && dwm_running; i += 1)
+            event_dispatch(&events[i]);
+        flush_dirty_monitors();
+        trace_flush();
+    }
+    return;
+}
+
+void
+event_dispatch(XEvent *event) {
+#ifdef STATS
+    uint64 start;
+#endif
+
+    if (trace_fd >= 0)
+        trace_write(TraceEvent, event, sizeof(*event));
+#ifdef XRANDR
+    if (randr_event_base >= 0
+        && (event->type == randr_event_base + RRScreenChangeNotify
+            || event->type == randr_event_base + RRNotify)) {
+        handler_randr_notify(event);
+        return;
+    }
+#endif /* XRANDR */
+    if (event->type >= LASTEvent || !handlers[event->type])
+        return;
+#ifdef STATS
+    start = stats_now();
+    handlers[event->type](event);
+    stats_record(&stats_handlers[event->type], stats_now() - start);
+#else
+    handlers[event->type](event);
+#endif
+    return;
+}
+
+void
+rules_compile(void) {
+    const char *patterns[RuleFieldLast][LENGTH(rules)];
+
+    for (int i = 0; i < LENGTH(rules); i += 1) {
+        patterns[RuleClass][i] = rules[i].class;
+        patterns[RuleInstance][i] = rules[i].instance;
+        patterns[RuleTitle][i] = rules[i].title;
+    }
+    for (int field = 0; field < RuleFieldLast; field += 1) {
+        for (int i = 0; i < LENGTH(rules); i += 1) {
+            if (!patterns[field][i])
+                rule_index.unset[field][i / 64] |= (uint64)1 << (i % 64);
+        }
+        rule_index.matchers[field] = matcher_create(patterns[field],
+                                                    LENGTH(rules));
+        if (!rule_index.matchers[field]) {
+            error(__func__, "Error compiling rules.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return;
+}
+
+/* matched gets the rules whose every given pattern occurs */
+void
+rules_match(const char *class, const char *instance, const char *title,
+            uint64 *matched) {
+    const char *texts[RuleFieldLast] = {
+        [RuleClass] = class,
+        [RuleInstance] = instance,
+        [RuleTitle] = title,
+    };
+
+    for (int word = 0; word < (int)RULE_WORDS; word += 1)
+        matched[word] = ~(uint64)0;
+
+    for (int field = 0; field < RuleFieldLast; field += 1) {
+        uint64 found[RULE_WORDS];
+
+        memcpy(found, rule_index.unset[field], sizeof(found));
+        matcher_run(rule_index.matchers[field], texts[field], found);
+        for (int word = 0; word < (int)RULE_WORDS; word += 1)
+            matched[word] &= found[word];
+    }
+    return;
+}
+
+void
+run_action(void (*function)(const Arg *), const Arg *arg) {
+#ifdef STATS
+    uint64 start = stats_now();
+
+    function(arg);
+    for (int i = 0; i < LENGTH(stats_action_names); i += 1) {
+        if (stats_action_names[i].function == function) {
+            stats_record(&stats_actions[i], stats_now() - start);
+            break;
+        }
+    }
+#else
+    function(arg);
+#endif
+    return;
+}
+
+#ifdef STATS
+uint64
+stats_now(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64)now.tv_sec*1000000000u + (uint64)now.tv_nsec;
+}
+
+void
+stats_record(StatsHistogram *histogram, uint64 ns) {
+    uint64 us = ns / 1000;
+    int bucket = 0;
+
+    while (us && bucket < STATS_BUCKETS - 1) {
+        us >>= 1;
+        bucket += 1;
+    }
+    histogram->buckets[bucket] += 1;
+    histogram->count += 1;
+    histogram->total_ns += ns;
+    histogram->max_ns = MAX(histogram->max_ns, ns);
+    return;
+}
+
+void
+stats_signal(int signal_number) {
+    (void) signal_number;
+    stats_requested = 1;
+    return;
+}
+
+/* One line per histogram or counter:
+ *     handler <event> <count> <total us> <max us> <bucket 0> <bucket 1> ...
+ *     action <function> <count> <total us> <max us> <bucket 0> ...
+ *     counter <name> <value>
+ * trailing empty buckets are left out. */
+void
+stats_publish(void) {
+    static Atom stats_atom = None;
+    size_t capacity = 4096;
+    size_t length = 0;
+    char *text = xcalloc(capacity, 1);
+
+    stats_requested = 0;
+    if (stats_atom == None)
+        stats_atom = XInternAtom(display, STATS_PROPERTY, False);
+
+#define STATS_APPEND(...) do { \
+    int n_; \
+    while ((n_ = snprintf(text + length, capacity - length, __VA_ARGS__)) >= 0 \
+           && (size_t)n_ >= capacity - length) { \
+        char *grown_; \
+        capacity *= 2; \
+        if (!(grown_ = realloc(text, capacity))) { \
+            error(__func__, "Error allocating statistics.\n"); \
+            free(text); \
+            return; \
+        } \
+        text = grown_; \
+    } \
+    length += (size_t)MAX(n_, 0); \
+} while (0)
+
+    for (int kind = 0; kind < 2; kind += 1) {
+        int number = kind ? LENGTH(stats_action_names) : LASTEvent;
+
+        for (int i = 0; i < number; i += 1) {
+            StatsHistogram *histogram = kind ? &stats_actions[i]
+                                             : &stats_handlers[i];
+            int last = STATS_BUCKETS - 1;
+
+            if (!histogram->count)
+                continue;
+            while (last > 0 && !histogram->buckets[last])
+                last -= 1;
+
+            STATS_APPEND("%s %s %llu %llu %llu", kind ? "action" : "handler",
+                         kind ? stats_action_names[i].name
+                              : stats_event_names[i] ? stats_event_names[i]
+                                                     : "unknown",
+                         (unsigned long long)histogram->count,
+                         (unsigned long long)histogram->total_ns / 1000,
+                         (unsigned long long)histogram->max_ns / 1000);
+            for (int b = 0; b <= last; b += 1)
+                STATS_APPEND(" %u", histogram->buckets[b]);
+            STATS_APPEND("\n");
+        }
+    }
+    for (int i = 0; i < StatsLast; i += 1) {
+        STATS_APPEND("counter %s %llu\n", stats_counter_names[i],
+                     (unsigned long long)stats_counters[i]);
+    }
+    STATS_APPEND("counter configures_skipped %lu\n", configures_skipped);
+#undef STATS_APPEND
+
+    XChangeProperty(display, root, stats_atom, XA_STRING, 8,
+                    PropModeReplace, (uchar *)text, (int)length);
+    XFlush(display);
+    free(text);
+    return;
+}
+#endif
+
+/* Opens $DWM_TRACE for appending, the header goes in only if it is new. */
+void
+trace_open(void) {
+    TraceHeader header = {
+        .magic = TRACE_MAGIC,
+        .version = TRACE_VERSION,
+        .event_size = sizeof(XEvent),
+        .root = root,
+        .screen_width = screen_width,
+        .screen_height = screen_height,
+    };
+    char *path;
+    struct stat st;
+
+    if (!(path = getenv(TRACE_ENV)) || !path[0])
+        return;
+    if ((trace_fd = open(path, O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0600)) < 0) {
+        error(__func__, "Error opening trace %s: %s\n", path, strerror(errno));
+        return;
+    }
+    if (fstat(trace_fd, &st) == 0 && st.st_size == 0
+        && write(trace_fd, &header, sizeof(header)) != sizeof(header)) {
+        error(__func__, "Error writing trace %s: %s\n", path, strerror(errno));
+        close(trace_fd);
+        trace_fd = -1;
+    }
+    return;
+}
+
+/* Queues one record, they reach the file once per event batch. */
+void
+trace_write(uint32 kind, const void *data, size_t size) {
+    TraceRecord record = { .kind = kind, .size = (uint32)size };
+    size_t padded = TRACE_PADDED(sizeof(record) + size);
+    struct timespec now;
+
+    if (padded > sizeof(trace_buffer))
+        return;
+    if (trace_used + padded > sizeof(trace_buffer))
+        trace_flush();
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    record.time_ns = (uint64)now.tv_sec*1000000000u + (uint64)now.tv_nsec;
+    memcpy(&trace_buffer[trace_used], &record, sizeof(record));
+    memcpy(&trace_buffer[trace_used + sizeof(record)], data, size);
+    memset(&trace_buffer[trace_used + sizeof(record) + size], 0,
+           padded - sizeof(record) - size);
+    trace_used += padded;
+    return;
+}
+
+void
+trace_flush(void) {
+    if (trace_fd < 0 || !trace_used)
+        return;
+    if (write(trace_fd, trace_buffer, trace_used) != (ssize_t)trace_used) {
+        error(__func__, "Error writing trace, stopping: %s\n", strerror(errno));
+        close(trace_fd);
+        trace_fd = -1;
+    }
+    trace_used = 0;
+    return;
+}
+
+int
+event_read_batch(XEvent *events, int max) {
+    int number_events = XEventsQueued(display, QueuedAfterReading);
+
+    number_events = MIN(number_events, max);
+    for (int i = 0; i < number_events; i += 1)
+        XNextEvent(display, &events[i]);
+    return number_events;
+}
+
+/* Drops events made pointless by a later one in the same batch: all but
+ * the last MotionNotify of a window, the last PropertyNotify of a
+ * (window, atom, state) triple, so a NewValue followed by a Delete keeps
+ * both, and the last Expose of a window, which grows to cover the areas
+ * of the ones dropped. The batch is walked backwards with the last event
+ * of every key in a small open addressed table. Returns the new count. */
+int
+event_compress(XEvent *events, int number_events) {
+    int slots[EVENT_COMPRESS_SLOTS] = {0};  /* index + 1 in events */
+    int kept = 0;
+
+    for (int i = number_events - 1; i >= 0; i -= 1) {
+        XEvent *event = &events[i];
+        Atom atom = 0;
+        int state = 0;
+        uint64 key;
+        uint slot;
+
+        if (event->type == PropertyNotify) {
+            atom = event->xproperty.atom;
+            state = event->xproperty.state;
+        } else if (event->type != MotionNotify && event->type != Expose) {
+            continue;
+        }
+        key = (uint64)event->xany.window*0x9E3779B97F4A7C15u
+              ^ (uint64)atom*0xC2B2AE3D27D4EB4Fu
+              ^ (uint64)(event->type << 1 | state);
+        slot = (uint)(key >> 32) & (EVENT_COMPRESS_SLOTS - 1);
+
+        while (slots[slot]) {
+            XEvent *later = &events[slots[slot] - 1];
+
+            if (later->type == event->type
+                && later->xany.window == event->xany.window
+                && (event->type != PropertyNotify
+                    || (later->xproperty.atom == atom
+                        && later->xproperty.state == state))) {
+                break;
+            }
+            slot = (slot + 1) & (EVENT_COMPRESS_SLOTS - 1);
+        }
+        if (!slots[slot]) {
+            slots[slot] = i + 1;
+            continue;
+        }
+
+        if (event->type == Expose) {
+            XExposeEvent *a = &event->xexpose;
+            XExposeEvent *b = &events[slots[slot] - 1].xexpose;
+            int x0 = MIN(a->x, b->x);
+            int y0 = MIN(a->y, b->y);
+            int x1 = MAX(a->x + a->width, b->x + b->width);
+            int y1 = MAX(a->y + a->height, b->y + b->height);
+
+            b->x = x0;
+            b->y = y0;
+            b->width = x1 - x0;
+            b->height = y1 - y0;
+        }
+        event->type = 0;    /* never used by the protocol */
+    }
+
+    for (int i = 0; i < number_events; i += 1) {
+        if (events[i].type)
+            events[kept++] = events[i];
+    }
+    return kept;
+}
+
+/* Drag loops only care about where the pointer is now: this replaces a
+ * MotionNotify by the last one queued before the button is released. */
+void
+event_drain_motion(XEvent *event) {
+    XEvent later;
+    Bool released = False;
+
+    while (XCheckIfEvent(display, &later,
+                         event_is_early_motion, (XPointer)&released)) {
+        *event = later;
+        released = False;
+    }
+    return;
+}
+
+Bool
+event_is_early_motion(Display *, XEvent *event, XPointer arg) {
+    Bool *released = (Bool *)arg;
+
+    if (event->type == ButtonRelease)
+        *released = True;
+    return event->type == MotionNotify && !*released;
+}
+
 int
 main(int argc, char *argv[]) {
     if (argc == 2 && !strcmp("-v", argv[1])) {
@@ -4140,6 +7581,7 @@ main(int argc, char *argv[]) {
         error(__func__, "Error opening display.\n");
         exit(EXIT_FAILURE);
     }
+    xcb_connection = XGetXCBConnection(display);
     {
         xerrorxlib = XSetErrorHandler(handler_xerror_start);
 
@@ -4165,27 +7607,29 @@ main(int argc, char *argv[]) {
 
     scan_windows_once();
 
-    for (Monitor *monitor = monitors; monitor; monitor = monitor->next) {
-        monitor_focus(monitor, false);
+    if (!snapshot_restore()) {
+        for (Monitor *monitor = monitors; monitor; monitor = monitor->next) {
+            monitor_focus(monitor, false);
 
-        view_tag(1 << 5);
-        set_layout(&layouts[2]);
+            view_tag(1 << 5);
+            set_layout(&layouts[2]);
 
-        toggle_bar(BarBottom);
+            toggle_bar(BarBottom);
 
-        view_tag(1 << 1);
+            view_tag(1 << 1);
+        }
     }
 
-    {
-        XEvent event;
-        XSync(display, False);
+    flush_dirty_monitors();
+    XSync(display, False);
+    event_loop();
 
-        while (dwm_running) {
-            XNextEvent(display, &event);
-            if (handlers[event.type])
-                handlers[event.type](&event);
-        }
-    }
+    if (font_cache[0])
+        drw_fontmap_save(drw, font_cache);
+    status_socket_close();
+    trace_flush();
+    if (dwm_restart)
+        snapshot_write();
 
     for (Monitor *monitor = monitors; monitor; monitor = monitor->next) {
         while (monitor->stack)
@@ -4193,9 +7637,22 @@ main(int argc, char *argv[]) {
     }
 
     XUngrabKey(display, AnyKey, AnyModifier, root);
+    DWM_DEBUG("%lu no-op configures skipped.\n", configures_skipped);
 
     while (monitors)
         monitor_cleanup_monitor(monitors);
+    free(client_windows.entries);
+    free(bar_windows.entries);
+    for (int i = 0; i < RuleFieldLast; i += 1)
+        matcher_free(rule_index.matchers[i]);
+    free(key_table.bindings);
+    free(client_list.windows);
+    free(client_list.stacking);
+    while (client_slabs) {
+        ClientSlab *slab = client_slabs;
+        client_slabs = slab->next;
+        free(slab);
+    }
 
     if (dwm_restart) {
         error(__func__, "restarting...");
@@ -0,0 +1,251 @@
+/* See LICENSE file for copyright and license details. */
+#include <stdbool.h>
+
+#include "layout.h"
+
+#define MAX(A, B)               ((A) > (B) ? (A) : (B))
+#define MIN(A, B)               ((A) < (B) ? (A) : (B))
+
+static int layout_pixels_height(const LayoutClient *, const LayoutRect *,
+                                bool);
+static int layout_pixels_width(const LayoutClient *, const LayoutRect *,
+                               bool);
+static void layout_place(const LayoutArea *, const LayoutClient *,
+                         LayoutRect *, int, int, int, int);
+
+/* Same rules as dwm applies to a tiled client that is not being moved
+ * by the mouse: keep it reachable inside the area, never smaller than
+ * min_size, then honour ICCCM size hints if asked to. */
+void
+layout_apply_hints(const LayoutArea *area, const LayoutClient *client,
+                   LayoutRect *rect) {
+    const SizeHints *hints = &client->hints;
+    int border = client->border;
+
+    rect->w = MAX(1, rect->w);
+    rect->h = MAX(1, rect->h);
+
+    if (rect->x >= area->x + area->w)
+        rect->x = area->x + area->w - (client->w + 2*border);
+    if (rect->y >= area->y + area->h)
+        rect->y = area->y + area->h - (client->h + 2*border);
+    if (rect->x + rect->w + 2*border <= area->x)
+        rect->x = area->x;
+    if (rect->y + rect->h + 2*border <= area->y)
+        rect->y = area->y;
+
+    if (rect->h < area->min_size)
+        rect->h = area->min_size;
+    if (rect->w < area->min_size)
+        rect->w = area->min_size;
+
+    if (client->apply_hints) {
+        /* see last two sentences in ICCCM 4.1.2.3 */
+        bool base_is_min = hints->base_w == hints->min_w
+                           && hints->base_h == hints->min_h;
+        if (!base_is_min) { /* temporarily remove base dimensions */
+            rect->w -= hints->base_w;
+            rect->h -= hints->base_h;
+        }
+
+        /* adjust for aspect limits */
+        if (hints->min_aspect > 0 && hints->max_aspect > 0) {
+            if (hints->max_aspect < (float)rect->w / (float)rect->h)
+                rect->w = rect->h*((int)(hints->max_aspect + 0.5f));
+            else if (hints->min_aspect < (float)rect->h / (float)rect->w)
+                rect->h = rect->w*((int)(hints->min_aspect + 0.5f));
+        }
+
+        if (base_is_min) { /* increment calculation requires this */
+            rect->w -= hints->base_w;
+            rect->h -= hints->base_h;
+        }
+
+        /* adjust for increment value */
+        if (hints->increment_w)
+            rect->w -= rect->w % hints->increment_w;
+        if (hints->increment_h)
+            rect->h -= rect->h % hints->increment_h;
+
+        /* restore base dimensions */
+        rect->w = MAX(rect->w + hints->base_w, hints->min_w);
+        rect->h = MAX(rect->h + hints->base_h, hints->min_h);
+        if (hints->max_w)
+            rect->w = MIN(rect->w, hints->max_w);
+        if (hints->max_h)
+            rect->h = MIN(rect->h, hints->max_h);
+    }
+    return;
+}
+
+void
+layout_place(const LayoutArea *area, const LayoutClient *client,
+             LayoutRect *rect, int x, int y, int w, int h) {
+    *rect = (LayoutRect){ .x = x, .y = y, .w = w, .h = h };
+    layout_apply_hints(area, client, rect);
+    return;
+}
+
+/* outer size once committed, a dropped border is given to the window */
+int
+layout_pixels_height(const LayoutClient *client, const LayoutRect *rect,
+                     bool borderless) {
+    return rect->h + (borderless ? 2*client->border : 0) + 2*client->border;
+}
+
+int
+layout_pixels_width(const LayoutClient *client, const LayoutRect *rect,
+                    bool borderless) {
+    return rect->w + (borderless ? 2*client->border : 0) + 2*client->border;
+}
+
+void
+layout_columns(const LayoutArea *area, const LayoutClient *clients,
+               int number_tiled, LayoutRect *rects) {
+    bool borderless = number_tiled == 1;
+    int x = 0;
+    int y = 0;
+    int mon_w;
+
+    if (number_tiled > area->number_masters) {
+        if (area->number_masters != 0)
+            mon_w = (int)((float)area->w*area->master_fact);
+        else
+            mon_w = 0;
+    } else {
+        mon_w = area->w;
+    }
+
+    for (int i = 0; i < number_tiled; i += 1) {
+        const LayoutClient *client = &clients[i];
+        int w;
+        int h;
+        if (i < area->number_masters) {
+            w = (mon_w - x) / (MIN(number_tiled, area->number_masters) - i);
+            layout_place(area, client, &rects[i],
+                         x + area->x, area->y,
+                         w - (2*client->border),
+                         area->h - (2*client->border));
+            x += layout_pixels_width(client, &rects[i], borderless);
+        } else {
+            h = (area->h - y) / (number_tiled - i);
+            layout_place(area, client, &rects[i],
+                         x + area->x, area->y + y,
+                         area->w - x - (2*client->border),
+                         h - (2*client->border));
+            y += layout_pixels_height(client, &rects[i], borderless);
+        }
+    }
+    return;
+}
+
+void
+layout_grid(const LayoutArea *area, const LayoutClient *clients,
+            int number_tiled, LayoutRect *rects) {
+    int columns = 0;
+    int rows;
+    int col_i = 0;
+    int row_i = 0;
+    int column_width;
+
+    if (number_tiled == 0)
+        return;
+
+    /* grid dimensions */
+    while (columns*columns < number_tiled) {
+        if (columns > (number_tiled / 2))
+            break;
+        columns += 1;
+    }
+
+    if (number_tiled == 5) {
+        /* set layout against the general calculation: not 1:2:2, but 2:3 */
+        columns = 2;
+    }
+    rows = number_tiled/columns;
+
+    if (columns == 0)
+        column_width = area->w;
+    else
+        column_width = area->w / columns;
+
+    for (int i = 0; i < number_tiled; i += 1) {
+        const LayoutClient *client = &clients[i];
+        int client_height;
+
+        if ((i/rows + 1) > (columns - number_tiled % columns))
+            rows = number_tiled/columns + 1;
+
+        client_height = area->h / rows;
+
+        layout_place(area, client, &rects[i],
+                     area->x + col_i*column_width,
+                     area->y + row_i*client_height,
+                     column_width - 2*client->border,
+                     client_height - 2*client->border);
+
+        row_i += 1;
+        if (row_i >= rows) {
+            row_i = 0;
+            col_i += 1;
+        }
+    }
+    return;
+}
+
+void
+layout_monocle(const LayoutArea *area, const LayoutClient *clients,
+               int number_tiled, LayoutRect *rects) {
+    for (int i = 0; i < number_tiled; i += 1) {
+        const LayoutClient *client = &clients[i];
+        layout_place(area, client, &rects[i],
+                     area->x, area->y,
+                     area->w - 2*client->border,
+                     area->h - 2*client->border);
+    }
+    return;
+}
+
+void
+layout_tile(const LayoutArea *area, const LayoutClient *clients,
+            int number_tiled, LayoutRect *rects) {
+    bool borderless = number_tiled == 1;
+    int min_number = MIN(number_tiled, area->number_masters);
+    int mon_w = 0;
+    int mon_y = 0;
+    int tile_y = 0;
+
+    if (number_tiled > area->number_masters) {
+        if (area->number_masters != 0)
+            mon_w = (int)((float)area->w*area->master_fact);
+        else
+            mon_w = 0;
+    } else {
+        mon_w = area->w;
+    }
+
+    for (int i = 0; i < number_tiled; i += 1) {
+        const LayoutClient *client = &clients[i];
+        int borders = 2*client->border;
+        int h;
+
+        if (i < area->number_masters) {
+            h = (area->h - mon_y) / (min_number - i);
+            layout_place(area, client, &rects[i],
+                         area->x, area->y + mon_y,
+                         mon_w - borders, h - borders);
+            h = layout_pixels_height(client, &rects[i], borderless);
+            if (mon_y + h < area->h)
+                mon_y += h;
+        } else {
+            h = (area->h - tile_y) / (number_tiled - i);
+            layout_place(area, client, &rects[i],
+                         area->x + mon_w, area->y + tile_y,
+                         area->w - mon_w - borders, h - borders);
+            h = layout_pixels_height(client, &rects[i], borderless);
+            if (tile_y + h < area->h)
+                tile_y += h;
+        }
+    }
+    return;
+}
@@ -0,0 +1,43 @@
+/* See LICENSE file for copyright and license details. */
+
+/* Pure layout engine: no X and no dwm state, so layouts can be run and
+ * measured on their own. A layout reads one LayoutClient per tiled
+ * client, in stacking order of the client list, and writes the
+ * geometry to request for each into the LayoutRect at the same index,
+ * size hints already applied. Diffing and applying it is up to dwm. */
+
+typedef struct SizeHints {
+    int base_w, base_h;
+    int min_w, min_h;
+    int max_w, max_h;
+    int increment_w, increment_h;
+    float min_aspect, max_aspect;
+} SizeHints;
+
+typedef struct LayoutClient {
+    SizeHints hints;
+    int w, h;          /* committed size, the clamps start from it */
+    int border;
+    bool apply_hints;
+} LayoutClient;
+
+typedef struct LayoutRect {
+    int x, y, w, h;
+} LayoutRect;
+
+typedef struct LayoutArea {
+    int x, y, w, h;
+    int number_masters;
+    float master_fact;
+    int min_size;      /* no window gets smaller than this */
+} LayoutArea;
+
+typedef void LayoutFunction(const LayoutArea *, const LayoutClient *,
+                            int, LayoutRect *);
+
+void layout_apply_hints(const LayoutArea *, const LayoutClient *,
+                        LayoutRect *);
+LayoutFunction layout_columns;
+LayoutFunction layout_grid;
+LayoutFunction layout_monocle;
+LayoutFunction layout_tile;
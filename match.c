@@ -0,0 +1,156 @@
+/* See LICENSE file for copyright and license details. */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "match.h"
+
+struct Matcher {
+    unsigned char classes[256]; /* byte to class, 0 for unused bytes */
+    int number_classes;
+    int number_states;
+    int *next;          /* number_states x number_classes, complete */
+    int *first_pattern; /* ending at a state, -1 for none */
+    int *output_link;   /* closest state on the fail chain with patterns */
+    int *next_pattern;  /* other patterns with the same text */
+};
+
+static void matcher_emit(const Matcher *, int, uint64_t *);
+
+Matcher *
+matcher_create(const char *const *patterns, int number_patterns) {
+    Matcher *matcher;
+    int *fail = NULL;
+    int *queue = NULL;
+    int head = 0;
+    int tail = 0;
+    size_t max_states = 1;
+
+    if (!(matcher = calloc(1, sizeof(*matcher))))
+        return NULL;
+
+    matcher->number_classes = 1;
+    for (int i = 0; i < number_patterns; i += 1) {
+        if (!patterns[i])
+            continue;
+        max_states += strlen(patterns[i]);
+        for (const char *c = patterns[i]; *c; c += 1) {
+            unsigned char byte = (unsigned char)*c;
+            if (!matcher->classes[byte]) {
+                matcher->classes[byte] = (unsigned char)matcher->number_classes;
+                matcher->number_classes += 1;
+            }
+        }
+    }
+
+    matcher->next = malloc(max_states*(size_t)matcher->number_classes
+                           *sizeof(*matcher->next));
+    matcher->first_pattern = malloc(max_states*sizeof(int));
+    matcher->output_link = malloc(max_states*sizeof(int));
+    matcher->next_pattern = malloc((size_t)(number_patterns + 1)*sizeof(int));
+    fail = malloc(max_states*sizeof(*fail));
+    queue = malloc(max_states*sizeof(*queue));
+    if (!matcher->next || !matcher->first_pattern || !matcher->output_link
+        || !matcher->next_pattern || !fail || !queue) {
+        free(fail);
+        free(queue);
+        matcher_free(matcher);
+        return NULL;
+    }
+
+    /* the trie, -1 standing for a missing edge */
+    memset(matcher->next, -1, max_states*(size_t)matcher->number_classes
+                              *sizeof(*matcher->next));
+    matcher->first_pattern[0] = -1;
+    matcher->number_states = 1;
+    for (int i = number_patterns - 1; i >= 0; i -= 1) {
+        int state = 0;
+
+        matcher->next_pattern[i] = -1;
+        if (!patterns[i])
+            continue;
+        for (const char *c = patterns[i]; *c; c += 1) {
+            int *edge = &matcher->next[state*matcher->number_classes
+                                       + matcher->classes[(unsigned char)*c]];
+            if (*edge < 0) {
+                *edge = matcher->number_states;
+                matcher->first_pattern[*edge] = -1;
+                matcher->number_states += 1;
+            }
+            state = *edge;
+        }
+        /* inserted backwards, so that the list is in pattern order */
+        matcher->next_pattern[i] = matcher->first_pattern[state];
+        matcher->first_pattern[state] = i;
+    }
+
+    /* breadth first, turning missing edges into the fail transitions */
+    fail[0] = 0;
+    matcher->output_link[0] = -1;
+    queue[tail++] = 0;
+    while (head < tail) {
+        int state = queue[head++];
+        int *edges = &matcher->next[state*matcher->number_classes];
+
+        for (int c = 0; c < matcher->number_classes; c += 1) {
+            int child = edges[c];
+            int fallback = state ? matcher->next[fail[state]
+                                                 *matcher->number_classes + c]
+                                 : 0;
+            if (child < 0) {
+                edges[c] = fallback;
+                continue;
+            }
+            fail[child] = fallback;
+            if (matcher->first_pattern[fallback] >= 0)
+                matcher->output_link[child] = fallback;
+            else
+                matcher->output_link[child] = matcher->output_link[fallback];
+            queue[tail++] = child;
+        }
+    }
+
+    free(fail);
+    free(queue);
+    return matcher;
+}
+
+void
+matcher_free(Matcher *matcher) {
+    if (!matcher)
+        return;
+    free(matcher->next);
+    free(matcher->first_pattern);
+    free(matcher->output_link);
+    free(matcher->next_pattern);
+    free(matcher);
+    return;
+}
+
+void
+matcher_emit(const Matcher *matcher, int state, uint64_t *found) {
+    if (matcher->first_pattern[state] < 0)
+        state = matcher->output_link[state];
+    for (; state >= 0; state = matcher->output_link[state]) {
+        for (int i = matcher->first_pattern[state];
+                 i >= 0;
+                 i = matcher->next_pattern[i]) {
+            found[i / 64] |= (uint64_t)1 << (i % 64);
+        }
+    }
+    return;
+}
+
+void
+matcher_run(const Matcher *matcher, const char *text, uint64_t *found) {
+    int state = 0;
+
+    matcher_emit(matcher, 0, found);
+    for (const char *c = text; *c; c += 1) {
+        state = matcher->next[state*matcher->number_classes
+                              + matcher->classes[(unsigned char)*c]];
+        if (state != 0)
+            matcher_emit(matcher, state, found);
+    }
+    return;
+}
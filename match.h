@@ -0,0 +1,16 @@
+/* See LICENSE file for copyright and license details. */
+
+/* Multi-pattern substring matcher (Aho-Corasick): finds which of a fixed
+ * set of patterns occur in a text with one pass over the text, however
+ * many patterns there are. Bytes appearing in no pattern share a single
+ * class, which keeps the transition table small. */
+
+typedef struct Matcher Matcher;
+
+/* NULL patterns never match, empty ones always do, like strstr(3).
+ * Returns NULL if out of memory. */
+Matcher *matcher_create(const char *const *patterns, int number_patterns);
+void matcher_free(Matcher *);
+/* sets bit i of found, (number_patterns + 63)/64 words the caller has
+ * cleared, for every pattern i that occurs in text */
+void matcher_run(const Matcher *, const char *text, uint64_t *found);
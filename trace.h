@@ -0,0 +1,33 @@
+/* See LICENSE file for copyright and license details. */
+
+/* Event trace written by dwm when $DWM_TRACE names a file and replayed
+ * by dwm-bench. The file only ever grows: one TraceHeader when it is
+ * created, then records, each a TraceRecord followed by size bytes of
+ * payload padded to TRACE_ALIGN, so it can be walked in place once
+ * mapped. A restarted dwm keeps appending to the same file. */
+#define TRACE_ENV     "DWM_TRACE"
+#define TRACE_MAGIC   0x31454341525444ULL /* "DTRACE1" */
+#define TRACE_VERSION 1u
+#define TRACE_ALIGN   8u
+#define TRACE_PADDED(N) (((N) + TRACE_ALIGN - 1) & ~(TRACE_ALIGN - 1))
+
+enum {
+	TraceEvent,  /* payload is the XEvent as dispatched */
+	TraceStatus, /* payload is the root WM_NAME text that was read */
+	TraceStatusBlock, /* payload is one line read from the status socket */
+};
+
+typedef struct {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t event_size; /* sizeof(XEvent) of the writer */
+	uint64_t root;       /* to tell top level windows apart */
+	int32_t screen_width;
+	int32_t screen_height;
+} TraceHeader;
+
+typedef struct {
+	uint64_t time_ns;    /* CLOCK_MONOTONIC */
+	uint32_t kind;
+	uint32_t size;
+} TraceRecord;